@@ -0,0 +1,1283 @@
+#include "contact_solver.h"
+#include "sat.h"
+#include "world.h"
+#include "world_batch.h"
+#include "base/trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace apollonia;
+
+// Headless benchmark of the demo scenes at fixed dt. Every scene is run
+// for a few warm up steps, then each timed step is recorded to report the
+// mean and percentiles. The scenes never sleep unless --sleep is given.
+//
+//   apollonia_bench [--scene=NAME] [--size=N] [--steps=N] [--warmup=N]
+//                   [--threads=N] [--sap] [--sleep] [--format=csv|json]
+//                   [--trace=PATH] [--checkpoint=PATH] [--worlds=N]
+//                   [--rays=N] [--rotation] [--sat] [--contacts]
+//                   [--rollback=N]
+//
+// Without --scene the whole suite is run. --trace writes the timed steps
+// of the last run as Chrome trace JSON, it needs APOLLONIA_TRACE.
+//
+// --checkpoint runs a round trip through World::SaveFile and LoadFile at
+// PATH instead of stepping: each scene is built, warmed up and saved, then
+// loaded into a new world. Both worlds are then stepped --steps times. It
+// reports the time to build the scene against the time to load it, and
+// whether the loaded world matches the saved one bit for bit after every
+// step. The run fails unless it does.
+//
+// --worlds steps N copies of each scene in a WorldBatch, the threads are
+// spread over the worlds. The step times are of the whole batch, the
+// steps per second count the steps of every world.
+//
+// --rays casts N random rays through each scene after every step instead
+// of timing the steps. It compares testing every body, World::RayCast one
+// ray at a time and World::RayCastClosest, and whether they agree.
+//
+// --rollback saves the state of each warmed up scene before every step
+// and, every N steps, restores the one of N steps back and steps again. It
+// times the saves and the restores, and the run fails unless every step
+// taken again gives the bodies of the first time bit for bit.
+//
+// --rotation times the integration of the body rotations alone, Rot
+// against the Mat22 rebuilt from cos and sin it replaced, and how far
+// each drifts from a rotation.
+//
+// --sat times each separating axis kernel the cpu supports on random
+// polygon pairs. The run fails unless every kernel finds the same axis
+// and separation as the scalar one.
+//
+// --contacts collides the touching bodies of each warmed up scene into new
+// arbiters, packs them in contact batches and solves them from the same
+// start with each contact kernel the cpu supports. The run fails unless
+// every kernel gives the scalar one's impulses and velocities bit for bit.
+
+struct Options {
+  std::string scene;
+  int size {0};
+  int steps {600};
+  int warmup {60};
+  size_t threads {ThreadPool::DefaultNumThreads()};
+  bool sap {false};
+  bool sleep {false};
+  bool json {false};
+  std::string trace;
+  std::string checkpoint;
+  size_t worlds {1};
+  size_t rays {0};
+  bool rotation {false};
+  bool sat {false};
+  bool contacts {false};
+  size_t rollback {0};
+};
+
+struct Result {
+  std::string scene;
+  int size;
+  size_t worlds;
+  // Of all worlds
+  size_t bodies;
+  size_t joints;
+  size_t threads;
+  int steps;
+  double mean_ms;
+  double p50_ms;
+  double p99_ms;
+  double steps_per_sec;
+  // Heap allocations of the timed steps, the run fails unless zero
+  size_t allocations;
+  // Mean of World::stats() over the timed steps, summed over the worlds of
+  // a batch. Zero without APOLLONIA_STATS.
+  StepStats phases;
+};
+
+static const Float kDt = 1.0f / 60;
+
+// Every heap allocation of the process so far, see bench_heap.cc
+size_t HeapAllocations();
+
+static Body* CreateGround(World& world, Float width) {
+  auto ground = world.NewBox(kInf, width, 1, {0, -0.5});
+  world.Add(ground);
+  return ground;
+}
+
+// A vertical stack of 'n' boxes
+static void CreateStack(World& world, int n) {
+  CreateGround(world, 20);
+  for (int i = 0; i < n; ++i) {
+    // Deterministic jitter, the stack is not perfectly aligned
+    Float x = 0.1f * ((i * 7) % 5 - 2) / 2;
+    auto body = world.NewBox(1, 1, 1, {x, 0.51f + 1.05f * i});
+    body->set_friction(0.2);
+    world.Add(body);
+  }
+}
+
+// A pyramid of 'n' rows
+static void CreatePyramid(World& world, int n) {
+  CreateGround(world, 1.125f * n + 20);
+  Vec2 x(-0.5625f * n, 0.75f);
+  Vec2 y;
+  for (int i = 0; i < n; ++i) {
+    y = x;
+    for (int j = i; j < n; ++j) {
+      auto body = world.NewBox(10, 1, 1, y);
+      body->set_friction(0.2);
+      world.Add(body);
+      y += Vec2(1.125f, 0.0f);
+    }
+    x += Vec2(0.5625f, 1.5f);
+  }
+}
+
+// A chain of 'n' links hanging from a static body
+static void CreateChain(World& world, int n) {
+  auto ground = world.NewBox(kInf, 100, 20, {0, -10});
+  ground->set_friction(0.4);
+  world.Add(ground);
+  const Float mass = 10.0f;
+  const Float y = 12.0f;
+  Body* last = ground;
+  for (int i = 0; i < n; ++i) {
+    auto box = world.NewBox(mass, 0.75, 0.25, {0.5f+i, y});
+    box->set_friction(0.4);
+    world.Add(box);
+    world.Add(world.NewRevoluteJoint(*last, *box, Vec2(i, y)));
+    last = box;
+  }
+}
+
+// 'n' pendulums swinging into each other
+static void CreateJoint(World& world, int n) {
+  auto ground = world.NewBox(kInf, 100 + n, 20, {0, -10});
+  world.Add(ground);
+  auto box1 = world.NewBox(500, 1, 1, {13.5, 11});
+  world.Add(box1);
+  world.Add(world.NewRevoluteJoint(*ground, *box1, {4.5, 11}));
+  for (int i = 0; i < n; ++i) {
+    auto box2 = world.NewBox(100, 1, 1, {3.5f-i, 2});
+    world.Add(box2);
+    world.Add(world.NewRevoluteJoint(*ground, *box2, {3.5f-i, 11}));
+  }
+}
+
+struct Scene {
+  const char* name;
+  void (*create)(World& world, int size);
+  // Sizes run by the suite
+  std::vector<int> sizes;
+};
+
+static const std::vector<Scene>& Scenes() {
+  static const std::vector<Scene> scenes = {
+    {"stack", CreateStack, {10, 20, 40}},
+    {"pyramid", CreatePyramid, {10, 20, 50, 100, 200}},
+    {"chain", CreateChain, {15, 100, 1000}},
+    {"joint", CreateJoint, {5, 50, 500}},
+  };
+  return scenes;
+}
+
+struct CheckpointResult {
+  std::string scene;
+  int size;
+  size_t bodies;
+  size_t joints;
+  // Best of the repetitions
+  double build_ms;
+  double save_ms;
+  double load_ms;
+  size_t file_bytes;
+  // The loaded bodies have the saved state bit for bit, and keep the state
+  // of the saved world stepping on
+  bool match;
+};
+
+struct RollbackResult {
+  std::string scene;
+  int size;
+  size_t bodies;
+  // Steps rolled back at a time
+  size_t depth;
+  // Mean of a save and of a restore
+  double save_ms;
+  double restore_ms;
+  // Steps taken again after a restore, all give the same bodies
+  size_t resteps;
+  bool match;
+};
+
+struct RayResult {
+  std::string scene;
+  int size;
+  size_t bodies;
+  size_t rays;
+  // Mean over the steps of casting all rays
+  double brute_ms;
+  double single_ms;
+  double batch_ms;
+  // Rays hitting a body, all ways find the same closest bodies
+  size_t hits;
+  bool match;
+};
+
+static double Percentile(const std::vector<double>& sorted, double p) {
+  auto idx = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+// Mean, percentiles and rate of the step times, sorting them
+static void SetTimes(std::vector<double>& times, Result& result) {
+  double total = 0;
+  for (auto t : times) {
+    total += t;
+  }
+  result.mean_ms = total / times.size();
+  std::sort(times.begin(), times.end());
+  result.p50_ms = Percentile(times, 0.5);
+  result.p99_ms = Percentile(times, 0.99);
+  result.steps_per_sec = 1000 * result.worlds / result.mean_ms;
+}
+
+// Add the phase times of a step to their mean over 'steps'
+static void AddPhases(const StepStats& stats, int steps, StepStats& phases) {
+  phases.broad_phase_ms += stats.broad_phase_ms / steps;
+  phases.narrow_phase_ms += stats.narrow_phase_ms / steps;
+  phases.islands_ms += stats.islands_ms / steps;
+  phases.pre_step_ms += stats.pre_step_ms / steps;
+  phases.solve_ms += stats.solve_ms / steps;
+  phases.integrate_ms += stats.integrate_ms / steps;
+}
+
+static Result RunBatch(const Scene& scene, int size, const Options& options) {
+  WorldBatch batch(options.worlds, {0, -9.8},
+                   options.sap ? BroadPhaseType::kSweepAndPrune : BroadPhaseType::kTree,
+                   options.threads);
+  batch.ForEach([&](World& world, size_t) {
+    if (!options.sleep) {
+      world.set_time_to_sleep(kInf);
+    }
+    scene.create(world, size);
+  });
+  for (int i = 0; i < options.warmup; ++i) {
+    batch.Step(kDt);
+  }
+
+  using Clock = std::chrono::steady_clock;
+  std::vector<double> times(options.steps);
+  size_t allocations = 0;
+  StepStats phases;
+  for (int i = 0; i < options.steps; ++i) {
+    auto before = HeapAllocations();
+    auto start = Clock::now();
+    batch.Step(kDt);
+    auto end = Clock::now();
+    times[i] = std::chrono::duration<double, std::milli>(end - start).count();
+    allocations += HeapAllocations() - before;
+    for (size_t w = 0; w < batch.size(); ++w) {
+      AddPhases(batch.world(w).stats(), options.steps, phases);
+    }
+  }
+
+  Result result;
+  result.scene = scene.name;
+  result.size = size;
+  result.worlds = batch.size();
+  result.bodies = 0;
+  result.joints = 0;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    result.bodies += batch.world(i).bodies().size();
+    result.joints += batch.world(i).joints().size();
+  }
+  result.threads = batch.num_threads();
+  result.steps = options.steps;
+  SetTimes(times, result);
+  result.allocations = allocations;
+  result.phases = phases;
+  return result;
+}
+
+static Result Run(const Scene& scene, int size, const Options& options) {
+  if (options.worlds > 1) {
+    return RunBatch(scene, size, options);
+  }
+  World world({0, -9.8}, options.sap ? BroadPhaseType::kSweepAndPrune
+                                     : BroadPhaseType::kTree,
+              options.threads);
+  if (!options.sleep) {
+    world.set_time_to_sleep(kInf);
+  }
+  scene.create(world, size);
+  // The threads register their trace rings in the warm up, so the timed
+  // steps do not allocate them
+  if (!options.trace.empty()) {
+    SetTraceThreadName("main");
+    StartTrace();
+  }
+  for (int i = 0; i < options.warmup; ++i) {
+    world.Step(kDt);
+  }
+
+  using Clock = std::chrono::steady_clock;
+  std::vector<double> times(options.steps);
+  size_t allocations = 0;
+  StepStats phases;
+  if (!options.trace.empty()) {
+    StartTrace();
+  }
+  for (int i = 0; i < options.steps; ++i) {
+    auto before = HeapAllocations();
+    auto start = Clock::now();
+    world.Step(kDt);
+    auto end = Clock::now();
+    times[i] = std::chrono::duration<double, std::milli>(end - start).count();
+    allocations += HeapAllocations() - before;
+    AddPhases(world.stats(), options.steps, phases);
+  }
+  StopTrace();
+
+  Result result;
+  result.scene = scene.name;
+  result.size = size;
+  result.worlds = 1;
+  result.bodies = world.bodies().size();
+  result.joints = world.joints().size();
+  result.threads = world.num_threads();
+  result.steps = options.steps;
+  SetTimes(times, result);
+  result.allocations = allocations;
+  result.phases = phases;
+  return result;
+}
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+static bool SameBody(const Body& a, const Body& b) {
+  return memcmp(&a.position(), &b.position(), sizeof(Vec2)) == 0 &&
+         memcmp(&a.rotation(), &b.rotation(), sizeof(Rot)) == 0 &&
+         memcmp(&a.velocity(), &b.velocity(), sizeof(Vec2)) == 0 &&
+         a.angular_velocity() == b.angular_velocity() &&
+         a.inertia() == b.inertia() && a.centroid().x == b.centroid().x &&
+         a.centroid().y == b.centroid().y && a.awake() == b.awake();
+}
+
+static CheckpointResult RunCheckpoint(const Scene& scene, int size,
+                                      const Options& options) {
+  static const int kRepeats = 5;
+  using Clock = std::chrono::steady_clock;
+  auto type = options.sap ? BroadPhaseType::kSweepAndPrune : BroadPhaseType::kTree;
+  CheckpointResult result;
+  result.scene = scene.name;
+  result.size = size;
+  result.build_ms = result.save_ms = result.load_ms = kInf;
+  result.match = true;
+  for (int r = 0; r < kRepeats; ++r) {
+    World world({0, -9.8}, type, options.threads);
+    auto start = Clock::now();
+    scene.create(world, size);
+    result.build_ms = std::min(result.build_ms, MillisecondsSince(start));
+    // Contacts to save with their impulses
+    for (int i = 0; i < options.warmup; ++i) {
+      world.Step(kDt);
+    }
+    start = Clock::now();
+    if (!world.SaveFile(options.checkpoint.c_str())) {
+      fprintf(stderr, "can not write checkpoint: %s\n", options.checkpoint.c_str());
+      exit(1);
+    }
+    result.save_ms = std::min(result.save_ms, MillisecondsSince(start));
+
+    World loaded({0, 0}, type, options.threads);
+    start = Clock::now();
+    if (!loaded.LoadFile(options.checkpoint.c_str())) {
+      fprintf(stderr, "can not load checkpoint: %s\n", options.checkpoint.c_str());
+      exit(1);
+    }
+    result.load_ms = std::min(result.load_ms, MillisecondsSince(start));
+
+    result.bodies = world.bodies().size();
+    result.joints = world.joints().size();
+    result.match = result.match && loaded.bodies().size() == result.bodies &&
+                   loaded.joints().size() == result.joints;
+    for (size_t i = 0; result.match && i < result.bodies; ++i) {
+      result.match = SameBody(*world.bodies()[i], *loaded.bodies()[i]);
+    }
+    // The load resumes the saved world, once is enough
+    if (r + 1 < kRepeats) {
+      continue;
+    }
+    for (int step = 0; result.match && step < options.steps; ++step) {
+      world.Step(kDt);
+      loaded.Step(kDt);
+      for (size_t i = 0; result.match && i < result.bodies; ++i) {
+        result.match = SameBody(*world.bodies()[i], *loaded.bodies()[i]);
+      }
+    }
+  }
+  auto file = fopen(options.checkpoint.c_str(), "rb");
+  if (!file) {
+    fprintf(stderr, "can not read checkpoint: %s\n", options.checkpoint.c_str());
+    exit(1);
+  }
+  fseek(file, 0, SEEK_END);
+  result.file_bytes = ftell(file);
+  fclose(file);
+  return result;
+}
+
+// Closest hit of 'ray' by testing every body
+static RayHit BruteRayCast(const World& world, const Ray& ray) {
+  RayHit closest;
+  for (auto body : world.bodies()) {
+    RayHit hit;
+    if (body->RayCast(ray, closest.fraction, hit)) {
+      closest = hit;
+      closest.body = body;
+    }
+  }
+  return closest;
+}
+
+// A ray through where two bodies touch hits either of them first
+static bool SameHit(const RayHit& a, const RayHit& b) {
+  return a.body == b.body ||
+         (a.body != nullptr && b.body != nullptr && a.fraction == b.fraction);
+}
+
+static RayResult RunRays(const Scene& scene, int size, const Options& options) {
+  static const int kSteps = 20;
+  using Clock = std::chrono::steady_clock;
+  World world({0, -9.8}, options.sap ? BroadPhaseType::kSweepAndPrune
+                                     : BroadPhaseType::kTree,
+              options.threads);
+  if (!options.sleep) {
+    world.set_time_to_sleep(kInf);
+  }
+  scene.create(world, size);
+  for (int i = 0; i < options.warmup; ++i) {
+    world.Step(kDt);
+  }
+
+  RayResult result;
+  result.scene = scene.name;
+  result.size = size;
+  result.bodies = world.bodies().size();
+  result.rays = options.rays;
+  result.brute_ms = result.single_ms = result.batch_ms = 0;
+  result.hits = 0;
+  result.match = true;
+  // Rays across the bounds of the scene
+  AABB bound = world.bodies()[0]->Bound();
+  for (auto body : world.bodies()) {
+    bound = AABB::Union(bound, body->Bound());
+  }
+  srand(1);
+  auto Random = [&](Float low, Float high) {
+    return low + (high - low) * rand() / RAND_MAX;
+  };
+  auto RandomPoint = [&]() {
+    return Vec2(Random(bound.lower.x, bound.upper.x),
+                Random(bound.lower.y, bound.upper.y));
+  };
+  std::vector<Ray> rays(options.rays);
+  std::vector<RayHit> brute(options.rays), single(options.rays), batch(options.rays);
+  for (int step = 0; step < kSteps; ++step) {
+    world.Step(kDt);
+    for (auto& ray : rays) {
+      ray = {RandomPoint(), RandomPoint()};
+    }
+    auto start = Clock::now();
+    world.RayCastClosest(rays.size(), rays.data(), batch.data());
+    result.batch_ms += MillisecondsSince(start) / kSteps;
+    start = Clock::now();
+    for (size_t i = 0; i < rays.size(); ++i) {
+      single[i] = RayHit();
+      world.RayCast(rays[i], [&single, i](const RayHit& hit) {
+        single[i] = hit;
+        return hit.fraction;
+      });
+    }
+    result.single_ms += MillisecondsSince(start) / kSteps;
+    start = Clock::now();
+    for (size_t i = 0; i < rays.size(); ++i) {
+      brute[i] = BruteRayCast(world, rays[i]);
+    }
+    result.brute_ms += MillisecondsSince(start) / kSteps;
+    for (size_t i = 0; i < rays.size(); ++i) {
+      result.hits += brute[i].body != nullptr;
+      result.match = result.match && SameHit(brute[i], single[i]) &&
+                     SameHit(brute[i], batch[i]);
+    }
+  }
+  result.hits /= kSteps;
+  return result;
+}
+
+static void PrintRays(const std::vector<RayResult>& results, bool json) {
+  if (!json) {
+    printf("scene,size,bodies,rays,brute_ms,single_ms,batch_ms,hits,match\n");
+  } else {
+    printf("[\n");
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto& r = results[i];
+    if (!json) {
+      printf("%s,%d,%zu,%zu,%.4f,%.4f,%.4f,%zu,%d\n", r.scene.c_str(), r.size,
+             r.bodies, r.rays, r.brute_ms, r.single_ms, r.batch_ms, r.hits, r.match);
+      continue;
+    }
+    printf("  {\"scene\": \"%s\", \"size\": %d, \"bodies\": %zu, \"rays\": %zu, "
+           "\"brute_ms\": %.4f, \"single_ms\": %.4f, \"batch_ms\": %.4f, "
+           "\"hits\": %zu, \"match\": %s}%s\n",
+           r.scene.c_str(), r.size, r.bodies, r.rays, r.brute_ms, r.single_ms,
+           r.batch_ms, r.hits, r.match ? "true" : "false",
+           i + 1 < results.size() ? "," : "");
+  }
+  if (json) {
+    printf("]\n");
+  }
+}
+
+// The state of a body SameBody() compares, kept to compare with stepping
+// again
+struct BodyState {
+  Vec2 position;
+  Rot rotation;
+  Vec2 velocity;
+  Float angular_velocity;
+  bool awake;
+};
+
+static void KeepBodies(const World& world, std::vector<BodyState>& states) {
+  states.resize(world.bodies().size());
+  for (size_t i = 0; i < states.size(); ++i) {
+    auto body = world.bodies()[i];
+    states[i] = {body->position(), body->rotation(), body->velocity(),
+                 body->angular_velocity(), body->awake()};
+  }
+}
+
+static bool SameBodies(const World& world, const std::vector<BodyState>& states) {
+  for (size_t i = 0; i < states.size(); ++i) {
+    auto body = world.bodies()[i];
+    auto& state = states[i];
+    if (memcmp(&body->position(), &state.position, sizeof(Vec2)) != 0 ||
+        memcmp(&body->rotation(), &state.rotation, sizeof(Rot)) != 0 ||
+        memcmp(&body->velocity(), &state.velocity, sizeof(Vec2)) != 0 ||
+        body->angular_velocity() != state.angular_velocity ||
+        body->awake() != state.awake) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static RollbackResult RunRollback(const Scene& scene, int size,
+                                  const Options& options) {
+  using Clock = std::chrono::steady_clock;
+  World world({0, -9.8}, options.sap ? BroadPhaseType::kSweepAndPrune
+                                     : BroadPhaseType::kTree,
+              options.threads);
+  if (!options.sleep) {
+    world.set_time_to_sleep(kInf);
+  }
+  scene.create(world, size);
+  for (int i = 0; i < options.warmup; ++i) {
+    world.Step(kDt);
+  }
+  auto depth = options.rollback;
+  world.set_state_capacity(depth);
+
+  RollbackResult result;
+  result.scene = scene.name;
+  result.size = size;
+  result.bodies = world.bodies().size();
+  result.depth = depth;
+  result.save_ms = result.restore_ms = 0;
+  result.resteps = 0;
+  result.match = true;
+  size_t restores = 0;
+  // The bodies after each of the last 'depth' steps
+  std::vector<std::vector<BodyState>> kept(depth);
+  for (int i = 0; i < options.steps; ++i) {
+    auto start = Clock::now();
+    world.SaveState();
+    result.save_ms += MillisecondsSince(start) / options.steps;
+    world.Step(kDt);
+    KeepBodies(world, kept[i % depth]);
+    if ((i + 1) % depth != 0) {
+      continue;
+    }
+    // Back to before the first of the kept steps
+    auto first = i + 1 - depth;
+    start = Clock::now();
+    if (!world.RestoreState(world.step_count() - depth)) {
+      result.match = false;
+      break;
+    }
+    result.restore_ms += MillisecondsSince(start);
+    ++restores;
+    for (size_t k = 0; k < depth; ++k) {
+      world.Step(kDt);
+      ++result.resteps;
+      result.match = result.match && SameBodies(world, kept[(first + k) % depth]);
+    }
+  }
+  if (restores > 0) {
+    result.restore_ms /= restores;
+  }
+  return result;
+}
+
+static void PrintRollbacks(const std::vector<RollbackResult>& results, bool json) {
+  if (!json) {
+    printf("scene,size,bodies,depth,save_ms,restore_ms,resteps,match\n");
+  } else {
+    printf("[\n");
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto& r = results[i];
+    if (!json) {
+      printf("%s,%d,%zu,%zu,%.4f,%.4f,%zu,%d\n", r.scene.c_str(), r.size,
+             r.bodies, r.depth, r.save_ms, r.restore_ms, r.resteps, r.match);
+      continue;
+    }
+    printf("  {\"scene\": \"%s\", \"size\": %d, \"bodies\": %zu, \"depth\": %zu, "
+           "\"save_ms\": %.4f, \"restore_ms\": %.4f, \"resteps\": %zu, "
+           "\"match\": %s}%s\n",
+           r.scene.c_str(), r.size, r.bodies, r.depth, r.save_ms, r.restore_ms,
+           r.resteps, r.match ? "true" : "false",
+           i + 1 < results.size() ? "," : "");
+  }
+  if (json) {
+    printf("]\n");
+  }
+}
+
+struct ContactResult {
+  std::string scene;
+  int size;
+  std::string kernel;
+  size_t arbiters;
+  size_t batches;
+  // Mean of an iteration over all batches
+  double iteration_us;
+  // Impulses and velocities differing from the scalar kernel
+  size_t mismatches;
+};
+
+static const char* kSimdLevelNames[] = {"scalar", "sse2", "avx2"};
+
+// Put the arbiter in the first of the last few batches that has a free
+// lane and none of its dynamic bodies, or in a new batch
+static void AddToBatch(std::vector<ContactBatch>& batches, const BodyStorage& bodies,
+                       Arbiter* arbiter, BodyId a, BodyId b) {
+  static const size_t kOpenBatches = 16;
+  auto Uses = [&bodies](const ContactBatch& batch, BodyId id) {
+    if (bodies.inv_mass[id] == 0) {
+      return false;
+    }
+    for (size_t lane = 0; lane < batch.count; ++lane) {
+      if (batch.a[lane] == id || batch.b[lane] == id) {
+        return true;
+      }
+    }
+    return false;
+  };
+  auto first = batches.size() > kOpenBatches ? batches.size() - kOpenBatches : 0;
+  for (auto i = first; i < batches.size(); ++i) {
+    auto& batch = batches[i];
+    if (batch.count < ContactBatch::kLanes && !Uses(batch, a) && !Uses(batch, b)) {
+      batch.a[batch.count] = a;
+      batch.b[batch.count] = b;
+      batch.arbiter[batch.count++] = arbiter;
+      return;
+    }
+  }
+  batches.emplace_back();
+  auto& batch = batches.back();
+  batch.a[0] = a;
+  batch.b[0] = b;
+  batch.arbiter[0] = arbiter;
+  batch.count = 1;
+}
+
+static std::vector<ContactResult> RunContacts(const Scene& scene, int size,
+                                              const Options& options) {
+  static const int kIterations = 10;
+  static const int kRounds = 20;
+  using Clock = std::chrono::steady_clock;
+  World world({0, -9.8}, options.sap ? BroadPhaseType::kSweepAndPrune
+                                     : BroadPhaseType::kTree, 1);
+  world.set_time_to_sleep(kInf);
+  scene.create(world, size);
+  for (int i = 0; i < options.warmup; ++i) {
+    world.Step(kDt);
+  }
+
+  // The bodies the kernels read and write, indexed by id
+  BodyStorage bodies;
+  for (size_t i = 0; i < world.bodies().size(); ++i) {
+    bodies.Add(nullptr);
+  }
+  for (auto body : world.bodies()) {
+    auto id = body->id();
+    bodies.velocity[id] = body->velocity();
+    bodies.angular_velocity[id] = body->angular_velocity();
+    bodies.inv_mass[id] = body->inv_mass();
+    bodies.inv_inertia[id] = body->inv_inertia();
+    bodies.friction[id] = body->friction();
+  }
+  std::vector<ContactBatch> batches;
+  size_t num_arbiters = 0;
+  Arbiter* arbiter = nullptr;
+  for (auto a : world.bodies()) {
+    world.QueryAABB(a->Bound(), [&](Body& b) {
+      if (a->id() >= b.id() || !a->ShouldCollide(b)) {
+        return true;
+      }
+      if (arbiter == nullptr) {
+        arbiter = world.NewArbiter(*a, b, Vec2());
+      }
+      if (Collide(*arbiter, *a, b)) {
+        AddToBatch(batches, bodies, arbiter, a->id(), b.id());
+        arbiter = nullptr;
+        ++num_arbiters;
+      }
+      return true;
+    });
+  }
+  for (auto& batch : batches) {
+    batch.PreStep(bodies, kDt);
+  }
+
+  // Solve the same start with each kernel, the scalar one first
+  std::vector<ContactResult> results;
+  BodyStorage scalar_bodies;
+  std::vector<ContactBatch> scalar_batches;
+  auto max_level = static_cast<int>(DetectSimdLevel());
+  for (int level = 0; level <= max_level; ++level) {
+    auto kernel = GetContactKernel(SimdLevel(level));
+    if (kernel == nullptr) {
+      continue;
+    }
+    ContactResult result;
+    result.scene = scene.name;
+    result.size = size;
+    result.kernel = kSimdLevelNames[level];
+    result.arbiters = num_arbiters;
+    result.batches = batches.size();
+    result.iteration_us = kInf;
+    result.mismatches = 0;
+    BodyStorage solved_bodies;
+    std::vector<ContactBatch> solved;
+    for (int round = 0; round < kRounds; ++round) {
+      solved_bodies = bodies;
+      solved = batches;
+      auto start = Clock::now();
+      for (int i = 0; i < kIterations; ++i) {
+        kernel(solved_bodies, solved.data(), solved.size());
+      }
+      result.iteration_us = std::min(result.iteration_us,
+                                     MillisecondsSince(start) * 1e3 / kIterations);
+    }
+    if (level == 0) {
+      scalar_bodies = solved_bodies;
+      scalar_batches = solved;
+    }
+    auto Differs = [](Float a, Float b) { return memcmp(&a, &b, sizeof(Float)) != 0; };
+    for (size_t i = 0; i < solved.size(); ++i) {
+      for (size_t k = 0; k < ContactBatch::kPoints; ++k) {
+        auto& point = solved[i].points[k];
+        auto& expected = scalar_batches[i].points[k];
+        for (size_t lane = 0; lane < solved[i].count; ++lane) {
+          result.mismatches += Differs(point.pn[lane], expected.pn[lane]);
+          result.mismatches += Differs(point.pt[lane], expected.pt[lane]);
+        }
+      }
+    }
+    for (size_t id = 0; id < bodies.size(); ++id) {
+      result.mismatches += Differs(solved_bodies.velocity[id].x, scalar_bodies.velocity[id].x);
+      result.mismatches += Differs(solved_bodies.velocity[id].y, scalar_bodies.velocity[id].y);
+      result.mismatches += Differs(solved_bodies.angular_velocity[id],
+                                   scalar_bodies.angular_velocity[id]);
+    }
+    results.push_back(result);
+  }
+  return results;
+}
+
+static void PrintContacts(const std::vector<ContactResult>& results, bool json) {
+  if (!json) {
+    printf("scene,size,kernel,arbiters,batches,iteration_us,mismatches\n");
+  } else {
+    printf("[\n");
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto& r = results[i];
+    if (!json) {
+      printf("%s,%d,%s,%zu,%zu,%.3f,%zu\n", r.scene.c_str(), r.size, r.kernel.c_str(),
+             r.arbiters, r.batches, r.iteration_us, r.mismatches);
+      continue;
+    }
+    printf("  {\"scene\": \"%s\", \"size\": %d, \"kernel\": \"%s\", "
+           "\"arbiters\": %zu, \"batches\": %zu, \"iteration_us\": %.3f, "
+           "\"mismatches\": %zu}%s\n",
+           r.scene.c_str(), r.size, r.kernel.c_str(), r.arbiters, r.batches,
+           r.iteration_us, r.mismatches, i + 1 < results.size() ? "," : "");
+  }
+  if (json) {
+    printf("]\n");
+  }
+}
+
+// Turn a rotation per body by its own angular velocity for every step
+static void RunRotation(bool json) {
+  static const size_t kBodies = 1 << 16;
+  static const int kSteps = 200;
+  using Clock = std::chrono::steady_clock;
+  std::vector<Float> angular_velocity(kBodies);
+  srand(1);
+  for (auto& w : angular_velocity) {
+    w = -10 + 20.0f * rand() / RAND_MAX;
+  }
+  std::vector<Mat22> matrices(kBodies, Mat22::I);
+  std::vector<Rot> rotations(kBodies);
+  // The vertices of a unit box turned by each rotation, as the polygons
+  // do after integrating
+  Vec2 box[4] = {{0.5f, 0.5f}, {-0.5f, 0.5f}, {-0.5f, -0.5f}, {0.5f, -0.5f}};
+  std::vector<Vec2> vertices(4 * kBodies);
+
+  auto start = Clock::now();
+  for (int step = 0; step < kSteps; ++step) {
+    for (size_t i = 0; i < kBodies; ++i) {
+      matrices[i] = Mat22(angular_velocity[i] * kDt) * matrices[i];
+      for (int k = 0; k < 4; ++k) {
+        vertices[4 * i + k] = matrices[i] * box[k];
+      }
+    }
+  }
+  auto mat22_ns = MillisecondsSince(start) * 1e6 / kSteps / kBodies;
+  start = Clock::now();
+  for (int step = 0; step < kSteps; ++step) {
+    for (size_t i = 0; i < kBodies; ++i) {
+      rotations[i] = rotations[i].Integrated(angular_velocity[i] * kDt);
+      for (int k = 0; k < 4; ++k) {
+        vertices[4 * i + k] = rotations[i] * box[k];
+      }
+    }
+  }
+  auto rot_ns = MillisecondsSince(start) * 1e6 / kSteps / kBodies;
+
+  // Distance from an orthonormal matrix, and from a unit complex number
+  double mat22_drift = 0, rot_drift = 0;
+  for (size_t i = 0; i < kBodies; ++i) {
+    auto& m = matrices[i];
+    auto& r = rotations[i];
+    mat22_drift = std::max<double>(mat22_drift, std::abs(m.Det() - 1));
+    rot_drift = std::max<double>(rot_drift, std::abs(r.c * r.c + r.s * r.s - 1));
+  }
+  if (!json) {
+    printf("type,bodies,steps,ns_per_body,max_drift\n");
+    printf("mat22,%zu,%d,%.3f,%.3g\n", kBodies, kSteps, mat22_ns, mat22_drift);
+    printf("rot,%zu,%d,%.3f,%.3g\n", kBodies, kSteps, rot_ns, rot_drift);
+    return;
+  }
+  printf("[\n");
+  printf("  {\"type\": \"mat22\", \"bodies\": %zu, \"steps\": %d, "
+         "\"ns_per_body\": %.3f, \"max_drift\": %.3g},\n",
+         kBodies, kSteps, mat22_ns, mat22_drift);
+  printf("  {\"type\": \"rot\", \"bodies\": %zu, \"steps\": %d, "
+         "\"ns_per_body\": %.3f, \"max_drift\": %.3g}\n",
+         kBodies, kSteps, rot_ns, rot_drift);
+  printf("]\n");
+}
+
+// A random convex polygon with its vertices on a circle, as the kernels
+// take them: the edges of A by first vertex and normal, the vertices of B
+// as structure of arrays
+struct SatPolygon {
+  std::vector<Vec2> vertices;
+  std::vector<Vec2> normals;
+  std::vector<Float> xs;
+  std::vector<Float> ys;
+};
+
+static SatPolygon RandomPolygon() {
+  static const size_t kMaxVertices = 16;
+  auto Random = [] { return Float(rand()) / RAND_MAX; };
+  SatPolygon polygon;
+  auto count = 3 + rand() % (kMaxVertices - 2);
+  std::vector<Float> angles(count);
+  for (auto& angle : angles) {
+    angle = 2 * kPi * Random();
+  }
+  std::sort(angles.begin(), angles.end());
+  Vec2 center(2 * Random() - 1, 2 * Random() - 1);
+  auto radius = 0.25f + Random();
+  for (auto angle : angles) {
+    polygon.vertices.push_back(center + Vec2(std::cos(angle), std::sin(angle)) * radius);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    auto& v = polygon.vertices[i];
+    polygon.normals.push_back((polygon.vertices[(i+1)%count] - v).Normal());
+    polygon.xs.push_back(v.x);
+    polygon.ys.push_back(v.y);
+  }
+  return polygon;
+}
+
+static bool RunSat(bool json) {
+  static const size_t kPolygons = 1 << 12;
+  static const int kRounds = 100;
+  using Clock = std::chrono::steady_clock;
+  srand(1);
+  std::vector<SatPolygon> polygons;
+  for (size_t i = 0; i < kPolygons; ++i) {
+    polygons.push_back(RandomPolygon());
+  }
+  // Polygon 'i' against the next one, about half of the pairs overlap
+  auto RunKernel = [&polygons](SatKernel kernel, size_t i, size_t& idx) {
+    auto& a = polygons[i];
+    auto& b = polygons[(i + 1) % kPolygons];
+    return kernel(a.vertices.data(), a.normals.data(), a.vertices.size(),
+                  b.xs.data(), b.ys.data(), b.xs.size(), idx);
+  };
+
+  auto scalar = GetSatKernel(SimdLevel::kScalar);
+  std::vector<Float> separations(kPolygons);
+  std::vector<size_t> axes(kPolygons);
+  for (size_t i = 0; i < kPolygons; ++i) {
+    separations[i] = RunKernel(scalar, i, axes[i]);
+  }
+
+  bool ok = true;
+  if (json) {
+    printf("[\n");
+  } else {
+    printf("kernel,pairs,ns_per_pair,mismatches\n");
+  }
+  auto max_level = static_cast<int>(DetectSimdLevel());
+  for (int level = 0; level <= max_level; ++level) {
+    auto kernel = GetSatKernel(SimdLevel(level));
+    if (kernel == nullptr) {
+      continue;
+    }
+    size_t mismatches = 0;
+    for (size_t i = 0; i < kPolygons; ++i) {
+      size_t idx = 0;
+      auto separation = RunKernel(kernel, i, idx);
+      if (idx != axes[i] || memcmp(&separation, &separations[i], sizeof(Float)) != 0) {
+        ++mismatches;
+      }
+    }
+    ok = ok && mismatches == 0;
+    // Kept so the calls are not optimized out
+    volatile Float sum = 0;
+    auto start = Clock::now();
+    for (int round = 0; round < kRounds; ++round) {
+      for (size_t i = 0; i < kPolygons; ++i) {
+        size_t idx = 0;
+        sum += RunKernel(kernel, i, idx);
+      }
+    }
+    auto ns = MillisecondsSince(start) * 1e6 / kRounds / kPolygons;
+    if (!json) {
+      printf("%s,%zu,%.3f,%zu\n", kSimdLevelNames[level], kPolygons, ns, mismatches);
+      continue;
+    }
+    printf("  {\"kernel\": \"%s\", \"pairs\": %zu, \"ns_per_pair\": %.3f, "
+           "\"mismatches\": %zu}%s\n", kSimdLevelNames[level], kPolygons, ns, mismatches,
+           level < max_level ? "," : "");
+  }
+  if (json) {
+    printf("]\n");
+  }
+  return ok;
+}
+
+static void PrintCheckpoints(const std::vector<CheckpointResult>& results,
+                             bool json) {
+  if (!json) {
+    printf("scene,size,bodies,joints,build_ms,save_ms,load_ms,file_bytes,match\n");
+  } else {
+    printf("[\n");
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto& r = results[i];
+    if (!json) {
+      printf("%s,%d,%zu,%zu,%.4f,%.4f,%.4f,%zu,%d\n", r.scene.c_str(), r.size,
+             r.bodies, r.joints, r.build_ms, r.save_ms, r.load_ms, r.file_bytes,
+             r.match);
+      continue;
+    }
+    printf("  {\"scene\": \"%s\", \"size\": %d, \"bodies\": %zu, \"joints\": %zu, "
+           "\"build_ms\": %.4f, \"save_ms\": %.4f, \"load_ms\": %.4f, "
+           "\"file_bytes\": %zu, \"match\": %s}%s\n",
+           r.scene.c_str(), r.size, r.bodies, r.joints, r.build_ms, r.save_ms,
+           r.load_ms, r.file_bytes, r.match ? "true" : "false",
+           i + 1 < results.size() ? "," : "");
+  }
+  if (json) {
+    printf("]\n");
+  }
+}
+
+static void PrintCsv(const std::vector<Result>& results) {
+  printf("scene,size,worlds,bodies,joints,threads,steps,mean_ms,p50_ms,p99_ms,"
+         "steps_per_sec,allocations,broad_phase_ms,narrow_phase_ms,islands_ms,"
+         "pre_step_ms,solve_ms,integrate_ms\n");
+  for (auto& r : results) {
+    auto& p = r.phases;
+    printf("%s,%d,%zu,%zu,%zu,%zu,%d,%.4f,%.4f,%.4f,%.1f,%zu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+           r.scene.c_str(), r.size, r.worlds, r.bodies, r.joints, r.threads, r.steps,
+           r.mean_ms, r.p50_ms, r.p99_ms, r.steps_per_sec, r.allocations,
+           p.broad_phase_ms, p.narrow_phase_ms, p.islands_ms, p.pre_step_ms,
+           p.solve_ms, p.integrate_ms);
+  }
+}
+
+static void PrintJson(const std::vector<Result>& results) {
+  printf("[\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto& r = results[i];
+    auto& p = r.phases;
+    printf("  {\"scene\": \"%s\", \"size\": %d, \"worlds\": %zu, \"bodies\": %zu, "
+           "\"joints\": %zu, \"threads\": %zu, \"steps\": %d, \"mean_ms\": %.4f, "
+           "\"p50_ms\": %.4f, \"p99_ms\": %.4f, \"steps_per_sec\": %.1f, "
+           "\"allocations\": %zu, \"broad_phase_ms\": %.4f, \"narrow_phase_ms\": %.4f, "
+           "\"islands_ms\": %.4f, \"pre_step_ms\": %.4f, \"solve_ms\": %.4f, "
+           "\"integrate_ms\": %.4f}%s\n",
+           r.scene.c_str(), r.size, r.worlds, r.bodies, r.joints, r.threads, r.steps,
+           r.mean_ms, r.p50_ms, r.p99_ms, r.steps_per_sec, r.allocations,
+           p.broad_phase_ms, p.narrow_phase_ms, p.islands_ms, p.pre_step_ms,
+           p.solve_ms, p.integrate_ms, i + 1 < results.size() ? "," : "");
+  }
+  printf("]\n");
+}
+
+// Match '--name=value' and point 'value' at the value
+static bool ParseFlag(const char* arg, const char* name, const char*& value) {
+  auto len = strlen(name);
+  if (strncmp(arg, name, len) != 0 || arg[len] != '=') {
+    return false;
+  }
+  value = arg + len + 1;
+  return true;
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; ++i) {
+    const char* value = nullptr;
+    if (ParseFlag(argv[i], "--scene", value)) {
+      options.scene = value;
+    } else if (ParseFlag(argv[i], "--size", value)) {
+      options.size = atoi(value);
+    } else if (ParseFlag(argv[i], "--steps", value)) {
+      options.steps = std::max(1, atoi(value));
+    } else if (ParseFlag(argv[i], "--warmup", value)) {
+      options.warmup = std::max(0, atoi(value));
+    } else if (ParseFlag(argv[i], "--threads", value)) {
+      options.threads = std::max(1, atoi(value));
+    } else if (ParseFlag(argv[i], "--format", value)) {
+      options.json = strcmp(value, "json") == 0;
+    } else if (ParseFlag(argv[i], "--trace", value)) {
+      options.trace = value;
+    } else if (ParseFlag(argv[i], "--worlds", value)) {
+      options.worlds = std::max(1, atoi(value));
+    } else if (ParseFlag(argv[i], "--rollback", value)) {
+      options.rollback = std::max(0, atoi(value));
+    } else if (ParseFlag(argv[i], "--rays", value)) {
+      options.rays = std::max(0, atoi(value));
+    } else if (ParseFlag(argv[i], "--checkpoint", value)) {
+      options.checkpoint = value;
+    } else if (strcmp(argv[i], "--rotation") == 0) {
+      options.rotation = true;
+    } else if (strcmp(argv[i], "--sat") == 0) {
+      options.sat = true;
+    } else if (strcmp(argv[i], "--contacts") == 0) {
+      options.contacts = true;
+    } else if (strcmp(argv[i], "--sap") == 0) {
+      options.sap = true;
+    } else if (strcmp(argv[i], "--sleep") == 0) {
+      options.sleep = true;
+    } else {
+      fprintf(stderr, "unknown option: %s\n", argv[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    return 1;
+  }
+  if (options.rotation) {
+    RunRotation(options.json);
+    return 0;
+  }
+  if (options.sat) {
+    if (!RunSat(options.json)) {
+      fprintf(stderr, "the separating axis kernels disagree\n");
+      return 1;
+    }
+    return 0;
+  }
+  if (!options.checkpoint.empty()) {
+    std::vector<CheckpointResult> results;
+    for (auto& scene : Scenes()) {
+      if (!options.scene.empty() && options.scene != scene.name) {
+        continue;
+      }
+      if (options.size > 0) {
+        results.push_back(RunCheckpoint(scene, options.size, options));
+        continue;
+      }
+      for (auto size : scene.sizes) {
+        results.push_back(RunCheckpoint(scene, size, options));
+      }
+    }
+    if (results.empty()) {
+      fprintf(stderr, "unknown scene: %s\n", options.scene.c_str());
+      return 1;
+    }
+    PrintCheckpoints(results, options.json);
+    for (auto& result : results) {
+      if (!result.match) {
+        fprintf(stderr, "%s %d: the loaded world does not resume the saved one\n",
+                result.scene.c_str(), result.size);
+        return 1;
+      }
+    }
+    return 0;
+  }
+  if (options.contacts) {
+    std::vector<ContactResult> results;
+    for (auto& scene : Scenes()) {
+      if (!options.scene.empty() && options.scene != scene.name) {
+        continue;
+      }
+      std::vector<int> sizes = scene.sizes;
+      if (options.size > 0) {
+        sizes = {options.size};
+      }
+      for (auto size : sizes) {
+        auto runs = RunContacts(scene, size, options);
+        results.insert(results.end(), runs.begin(), runs.end());
+      }
+    }
+    if (results.empty()) {
+      fprintf(stderr, "unknown scene: %s\n", options.scene.c_str());
+      return 1;
+    }
+    PrintContacts(results, options.json);
+    for (auto& r : results) {
+      if (r.mismatches > 0) {
+        fprintf(stderr, "%s %d: the %s contact kernel differs from the scalar one\n",
+                r.scene.c_str(), r.size, r.kernel.c_str());
+        return 1;
+      }
+    }
+    return 0;
+  }
+  if (options.rollback > 0) {
+    std::vector<RollbackResult> results;
+    for (auto& scene : Scenes()) {
+      if (!options.scene.empty() && options.scene != scene.name) {
+        continue;
+      }
+      if (options.size > 0) {
+        results.push_back(RunRollback(scene, options.size, options));
+        continue;
+      }
+      for (auto size : scene.sizes) {
+        results.push_back(RunRollback(scene, size, options));
+      }
+    }
+    if (results.empty()) {
+      fprintf(stderr, "unknown scene: %s\n", options.scene.c_str());
+      return 1;
+    }
+    PrintRollbacks(results, options.json);
+    for (auto& r : results) {
+      if (!r.match) {
+        fprintf(stderr, "%s %d: stepping again after a restore differs\n",
+                r.scene.c_str(), r.size);
+        return 1;
+      }
+    }
+    return 0;
+  }
+  if (options.rays > 0) {
+    std::vector<RayResult> results;
+    for (auto& scene : Scenes()) {
+      if (!options.scene.empty() && options.scene != scene.name) {
+        continue;
+      }
+      if (options.size > 0) {
+        results.push_back(RunRays(scene, options.size, options));
+        continue;
+      }
+      for (auto size : scene.sizes) {
+        results.push_back(RunRays(scene, size, options));
+      }
+    }
+    if (results.empty()) {
+      fprintf(stderr, "unknown scene: %s\n", options.scene.c_str());
+      return 1;
+    }
+    PrintRays(results, options.json);
+    return 0;
+  }
+
+  std::vector<Result> results;
+  for (auto& scene : Scenes()) {
+    if (!options.scene.empty() && options.scene != scene.name) {
+      continue;
+    }
+    if (options.size > 0) {
+      results.push_back(Run(scene, options.size, options));
+      continue;
+    }
+    for (auto size : scene.sizes) {
+      results.push_back(Run(scene, size, options));
+    }
+  }
+  if (results.empty()) {
+    fprintf(stderr, "unknown scene: %s\n", options.scene.c_str());
+    return 1;
+  }
+  if (!options.trace.empty() && !WriteChromeTrace(options.trace.c_str())) {
+    fprintf(stderr, "can not write trace: %s\n", options.trace.c_str());
+    return 1;
+  }
+  if (options.json) {
+    PrintJson(results);
+  } else {
+    PrintCsv(results);
+  }
+  // A warmed up step must not touch the heap
+  int status = 0;
+  for (auto& r : results) {
+    if (r.allocations > 0) {
+      fprintf(stderr, "%s %d allocated %zu times after warm up\n",
+              r.scene.c_str(), r.size, r.allocations);
+      status = 1;
+    }
+  }
+  return status;
+}
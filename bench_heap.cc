@@ -0,0 +1,31 @@
+// Replacements of the global allocation functions for the bench, counting
+// every heap allocation of the process. World::step_allocations() only
+// sees the engine's own containers, pools and arenas. They live apart from
+// bench.cc so they are never inlined into a caller, where GCC would take
+// the free() of a block from operator new for a mismatch.
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<size_t> heap_allocations {0};
+
+size_t HeapAllocations() {
+  return heap_allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size) {
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto ptr = malloc(size > 0 ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
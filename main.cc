@@ -2,6 +2,7 @@
 #include "collision.h"
 #include "joint.h"
 #include "world.h"
+#include "base/trace.h"
 
 #include <GLFW/glfw3.h>
 #include <atomic>
@@ -19,35 +20,50 @@ static constexpr int win_width = 800;
 static constexpr int win_height = 800;
 static GLFWwindow* window = nullptr;
 
-static void DrawBody(const PolygonBody& body) {
-  if (body.mass() == kInf) {
+static void SetColor(const Snapshot::BodyState& body) {
+  if (body.is_static) {
     glColor3f(1, 1, 1);
   } else {
     glColor3f(0.8, 0.8, 0);
   }
+}
+
+static void DrawPolygon(const Snapshot& snapshot, const Snapshot::BodyState& body) {
+  SetColor(body);
   glBegin(GL_LINE_LOOP);
-  for (size_t i = 0; i < body.Count(); ++i) {
-    auto point = body.LocalToWorld(body[i]);
-    glVertex2f(point.x, point.y);
+  auto vertices = &snapshot.vertices[body.vertex_begin];
+  for (size_t i = 0; i < body.vertex_count; ++i) {
+    glVertex2f(vertices[i].x, vertices[i].y);
   }
   glEnd();
 }
 
-static void DrawJoint(const RevoluteJoint& joint) {
-  auto centroida = joint.a().LocalToWorld(joint.a().centroid());
-  auto anchora = joint.WorldAnchorA();
-  auto centroidb = joint.b().LocalToWorld(joint.b().centroid());
-  auto anchorb = joint.WorldAnchorB();
+static void DrawCircle(const Snapshot::BodyState& body) {
+  SetColor(body);
+  static const int kSegments = 24;
+  auto& center = body.position;
+  glBegin(GL_LINE_LOOP);
+  // Start from the center to show the rotation
+  glVertex2f(center.x, center.y);
+  for (int i = 0; i < kSegments; ++i) {
+    auto angle = 2 * kPi * i / kSegments;
+    auto v = center + body.rotation * Vec2(body.radius * cos(angle),
+                                           body.radius * sin(angle));
+    glVertex2f(v.x, v.y);
+  }
+  glEnd();
+}
 
+static void DrawJoint(const Snapshot::JointState& joint) {
   glColor3f(0.6, 0.6, 0.6);
   glBegin(GL_LINES);
-  if (joint.a().mass() != kInf) {
-    glVertex2f(centroida.x, centroida.y);
-    glVertex2f(anchora.x, anchora.y);
+  if (!joint.is_static_a) {
+    glVertex2f(joint.centroid_a.x, joint.centroid_a.y);
+    glVertex2f(joint.anchor_a.x, joint.anchor_a.y);
   }
-  if (joint.b().mass() != kInf) {
-    glVertex2f(centroidb.x, centroidb.y);
-    glVertex2f(anchorb.x, anchorb.y);
+  if (!joint.is_static_b) {
+    glVertex2f(joint.centroid_b.x, joint.centroid_b.y);
+    glVertex2f(joint.anchor_b.x, joint.anchor_b.y);
   }
   glEnd();
 }
@@ -72,6 +88,7 @@ static void UpdateTitle(double dt) {
 */
 
 static void Display() {
+  APOLLONIA_TRACE_SCOPE("Display");
   glViewport(0, 0, win_width, win_height);
   glMatrixMode(GL_PROJECTION);
   glLoadIdentity();
@@ -83,33 +100,35 @@ static void Display() {
   glTranslatef(0.0f, -8.0f, 0.0f);
 
   glClear(GL_COLOR_BUFFER_BIT);
-  world.Lock();
-  for (auto body : world.bodies()) {
-    // TODO(wgtdkp):
-    DrawBody(dynamic_cast<PolygonBody&>(*body));
+  // Drawn from the latest snapshot, the step is never blocked
+  auto& snapshot = world.ReadSnapshot();
+  for (auto& body : snapshot.bodies) {
+    switch (body.shape_type) {
+    case ShapeType::kPolygon: DrawPolygon(snapshot, body); break;
+    case ShapeType::kCircle: DrawCircle(body); break;
+    }
   }
-  for (auto joint : world.joints()) {
-    DrawJoint(dynamic_cast<RevoluteJoint&>(*joint));
+  for (auto& joint : snapshot.joints) {
+    DrawJoint(joint);
   }
-  world.Unlock();
   glfwSwapBuffers(window);
 }
 
 static PolygonBody* CreateFencing() {
-  auto ground = World::NewBox(kInf, 20, 1, {0, -0.5});
+  auto ground = world.NewBox(kInf, 20, 1, {0, -0.5});
   world.Add(ground);
-  world.Add(World::NewBox(kInf, 20, 1, {0, 16.5}));
-  world.Add(World::NewBox(kInf, 1, 18, {-9.5, 8}));
-  world.Add(World::NewBox(kInf, 1, 18, {9.5, 8}));
+  world.Add(world.NewBox(kInf, 20, 1, {0, 16.5}));
+  world.Add(world.NewBox(kInf, 1, 18, {-9.5, 8}));
+  world.Add(world.NewBox(kInf, 1, 18, {9.5, 8}));
   return ground;
 }
 
 static void TestPolygon() {
   world.Lock();
   CreateFencing();
-  world.Add(World::NewPolygonBody(200, {{-1, 0}, {1, 0}, {0, 1}}, {-1, 0}));
-  world.Add(World::NewPolygonBody(200, {{-1, 0}, {1, 0}, {0, 1}}, {1, 0}));
-  world.Add(World::NewBox(200, 3, 6, {0, 8}));
+  world.Add(world.NewPolygonBody(200, {{-1, 0}, {1, 0}, {0, 1}}, {-1, 0}));
+  world.Add(world.NewPolygonBody(200, {{-1, 0}, {1, 0}, {0, 1}}, {1, 0}));
+  world.Add(world.NewBox(200, 3, 6, {0, 8}));
   world.Unlock();
 }
 
@@ -123,7 +142,7 @@ static void TestStack() {
   CreateFencing();
   for (int i = 0; i < 10; ++i) {
     Float x = Random(-0.1f, 0.1f);
-    auto body = World::NewBox(1, 1, 1, {x, 0.51f + 1.05f * i});
+    auto body = world.NewBox(1, 1, 1, {x, 0.51f + 1.05f * i});
     body->set_friction(0.2);
     world.Add(body);
   }
@@ -139,7 +158,7 @@ static void TestPyramid() {
   for (int i = 0; i < n; ++i) {
     y = x;
     for (int j = i; j < n; ++j) {
-      auto body = World::NewBox(10, 1, 1, y);
+      auto body = world.NewBox(10, 1, 1, y);
       body->set_friction(0.2);
       world.Add(body);
       y += Vec2(1.125f, 0.0f);
@@ -151,18 +170,18 @@ static void TestPyramid() {
 
 static void TestJoint() {
   world.Lock();
-  auto ground = World::NewBox(kInf, 100, 20, {0, -10});
+  auto ground = world.NewBox(kInf, 100, 20, {0, -10});
   world.Add(ground);
 
-  auto box1 = World::NewBox(500, 1, 1, {13.5, 11});
+  auto box1 = world.NewBox(500, 1, 1, {13.5, 11});
   world.Add(box1);
-  auto joint1 = World::NewRevoluteJoint(*ground, *box1, {4.5, 11});
+  auto joint1 = world.NewRevoluteJoint(*ground, *box1, {4.5, 11});
   world.Add(joint1);
 
   for (size_t i = 0; i < 5; ++i) {
-    auto box2 = World::NewBox(100, 1, 1, {3.5f-i, 2});
+    auto box2 = world.NewBox(100, 1, 1, {3.5f-i, 2});
     world.Add(box2);
-    auto joint2 = World::NewRevoluteJoint(*ground, *box2, {3.5f-i, 11});
+    auto joint2 = world.NewRevoluteJoint(*ground, *box2, {3.5f-i, 11});
     world.Add(joint2);
   }
   world.Unlock();
@@ -170,7 +189,7 @@ static void TestJoint() {
 
 static void TestChain() {
   world.Lock();
-  auto ground = World::NewBox(kInf, 100, 20, {0, -10});
+  auto ground = world.NewBox(kInf, 100, 20, {0, -10});
   ground->set_friction(0.4);
   world.Add(ground);
 
@@ -178,16 +197,49 @@ static void TestChain() {
   const Float y = 12.0f;
   Body* last = ground;
   for (int i = 0; i < 15; ++i) {
-    auto box = World::NewBox(mass, 0.75, 0.25, {0.5f+i, y});
+    auto box = world.NewBox(mass, 0.75, 0.25, {0.5f+i, y});
     box->set_friction(0.4);
     world.Add(box);
-    auto joint = World::NewRevoluteJoint(*last, *box, Vec2(i, y));
+    auto joint = world.NewRevoluteJoint(*last, *box, Vec2(i, y));
     world.Add(joint);
     last = box;
   }
   world.Unlock();
 }
 
+// A pile of circles poured on a few boxes
+static void TestCircles() {
+  world.Lock();
+  CreateFencing();
+  for (int i = 0; i < 3; ++i) {
+    world.Add(world.NewBox(kInf, 2, 0.5, {-5.0f + 5 * i, 4}));
+  }
+  for (int i = 0; i < 20; ++i) {
+    for (int j = 0; j < 10; ++j) {
+      Float x = Random(-0.05f, 0.05f);
+      auto body = world.NewCircle(1, 0.3, {-8.0f + 0.8f * i + x, 6.0f + 0.8f * j});
+      body->set_friction(0.2);
+      world.Add(body);
+    }
+  }
+  world.Unlock();
+}
+
+// Thin fast bars fired at the fencing, the bullets stop at the wall while
+// the others go through it
+static void TestBullets() {
+  world.Lock();
+  CreateFencing();
+  for (int i = 0; i < 10; ++i) {
+    auto body = world.NewBox(1, 0.1f, 0.4f, {-6.0f, 1.0f + 1.4f * i});
+    body->set_bullet(i % 2 == 0);
+    body->set_velocity({300, 0});
+    body->set_angular_velocity(Random(-5, 5));
+    world.Add(body);
+  }
+  world.Unlock();
+}
+
 static void Keyboard(GLFWwindow* window,
     int key, int scancode, int action, int mods) {
   world.Lock();
@@ -199,6 +251,8 @@ static void Keyboard(GLFWwindow* window,
   case '3': TestPyramid(); break;
   case '4': TestJoint(); break;
   case '5': TestChain(); break;
+  case '6': TestCircles(); break;
+  case '7': TestBullets(); break;
   }
 }
 
@@ -214,6 +268,7 @@ static void Reshape(int width, int height) {
 static std::atomic<bool> should_stop{false};
 static void ApolloniaRun() {
   using namespace std::chrono_literals;
+  SetTraceThreadName("physics");
   TestPyramid();
   while (!should_stop) {
     // We give up some time for drawing
@@ -241,6 +296,11 @@ int main() {
 
   glfwSetKeyCallback(window, Keyboard);
 
+  world.set_publish_snapshots(true);
+#ifdef APOLLONIA_TRACE
+  SetTraceThreadName("render");
+  StartTrace();
+#endif
   std::thread apollo_thread(ApolloniaRun);
   while (!glfwWindowShouldClose(window)) {
     Display();
@@ -249,5 +309,10 @@ int main() {
   glfwTerminate();
   should_stop = true;
   apollo_thread.join();
+#ifdef APOLLONIA_TRACE
+  // The last spans of every thread
+  StopTrace();
+  WriteChromeTrace("apollonia_trace.json");
+#endif
   return 0;
 }
@@ -0,0 +1,86 @@
+#include "arbiter_cache.h"
+#include <algorithm>
+
+namespace apollonia {
+
+const uint64_t ArbiterCache::kEmpty;
+const uint64_t ArbiterCache::kTombstone;
+
+Arbiter* ArbiterCache::Touch(ArbiterKey key) {
+  if (slots_.empty()) {
+    return nullptr;
+  }
+  auto mask = slots_.size() - 1;
+  for (auto i = key.Hash() & mask; slots_[i].key != kEmpty; i = (i + 1) & mask) {
+    if (slots_[i].key == key.value()) {
+      slots_[i].touched = true;
+      return slots_[i].arbiter;
+    }
+  }
+  return nullptr;
+}
+
+void ArbiterCache::Insert(ArbiterKey key, Arbiter* arbiter) {
+  assert(key.value() != kEmpty && key.value() != kTombstone);
+  // Keep at least half of the slots empty so that probes stay short
+  if ((size_ + tombstones_ + 1) * 2 > slots_.size()) {
+    Rehash(size_ + 1);
+  }
+  auto mask = slots_.size() - 1;
+  auto i = key.Hash() & mask;
+  while (slots_[i].IsLive()) {
+    assert(slots_[i].key != key.value());
+    i = (i + 1) & mask;
+  }
+  if (slots_[i].key == kTombstone) {
+    --tombstones_;
+  }
+  slots_[i].key = key.value();
+  slots_[i].arbiter = arbiter;
+  slots_[i].touched = true;
+  ++size_;
+}
+
+void ArbiterCache::Clear() {
+  slots_.clear();
+  size_ = 0;
+  tombstones_ = 0;
+}
+
+void ArbiterCache::Reserve(size_t count) {
+  if (CapacityFor(count) > slots_.size()) {
+    Rehash(count);
+  }
+  // The next rehash swaps in the scratch slots
+  scratch_.reserve(slots_.size());
+}
+
+size_t ArbiterCache::CapacityFor(size_t count) {
+  auto capacity = kMinCapacity;
+  while (capacity < count * 4) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+void ArbiterCache::Rehash(size_t count) {
+  auto capacity = CapacityFor(std::max(count, size_ + 1));
+  scratch_.assign(capacity, Slot());
+  slots_.swap(scratch_);
+  size_ = 0;
+  tombstones_ = 0;
+  auto mask = capacity - 1;
+  for (auto& slot : scratch_) {
+    if (!slot.IsLive()) {
+      continue;
+    }
+    auto i = ArbiterKey(slot.key).Hash() & mask;
+    while (slots_[i].key != kEmpty) {
+      i = (i + 1) & mask;
+    }
+    slots_[i] = slot;
+    ++size_;
+  }
+}
+
+}
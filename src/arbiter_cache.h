@@ -0,0 +1,188 @@
+#pragma once
+
+#include "apollonia.h"
+#include "base/allocator.h"
+#include "collision.h"
+#include <cstdint>
+
+namespace apollonia {
+
+// Open addressing hash table of the arbiters in contact, keyed by the ids
+// of the body pairs. An arbiter persists as long as its pair is touched in
+// every step, untouched ones are offered for eviction together by Sweep().
+class ArbiterCache {
+ public:
+  ArbiterCache() {}
+  DISABLE_COPY_AND_ASSIGN(ArbiterCache)
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Find the arbiter of the pair and keep it alive in this step,
+  // return nullptr if the pair is not in the cache.
+  Arbiter* Touch(ArbiterKey key);
+  // Add the arbiter of a pair not in the cache, alive in this step
+  void Insert(ArbiterKey key, Arbiter* arbiter);
+  // Pass the arbiters not touched since last sweep to 'evict(arbiter)',
+  // they are dropped from the cache if it returns true.
+  template <typename Evict>
+  void Sweep(Evict&& evict);
+  void Clear();
+  // Size the table for 'count' arbiters, so inserting up to that many
+  // does not allocate
+  void Reserve(size_t count);
+  // Take the slots of 'other' as they are, so the iteration order is the
+  // same. The arbiter of each is replaced by 'copy(arbiter)'.
+  template <typename Copy>
+  void CopyFrom(const ArbiterCache& other, Copy&& copy);
+
+  template <typename Func>
+  void ForEach(Func&& func) const;
+  size_t capacity() const { return slots_.size(); }
+  // Call 'func(index, key, arbiter)' for every slot in use in order, the
+  // arbiter is nullptr for the tombstones. A checkpoint saves them so that
+  // Assign() gives back the same probe and iteration order.
+  template <typename Func>
+  void ForEachUsedSlot(Func&& func) const;
+  // Whether 'count' slots in use at 'index(i)' with the keys 'key(i)' make
+  // a table of 'capacity' slots as Insert() leaves it, with 'live(i)' true
+  // for every live one. For checking a checkpoint before taking it.
+  template <typename Index, typename Key, typename Live>
+  static bool ValidSlots(size_t capacity, size_t count, Index&& index, Key&& key,
+                         Live&& live);
+  // Take the slots checked by ValidSlots(), the live slot i gets the
+  // arbiter 'arbiter(i)', untouched
+  template <typename Index, typename Key, typename Make>
+  void Assign(size_t capacity, size_t count, Index&& index, Key&& key,
+              Make&& arbiter);
+
+ private:
+  // Key values never produced by a pair
+  static const uint64_t kEmpty = 0;
+  static const uint64_t kTombstone = UINT64_MAX;
+  static const size_t kMinCapacity = 16;
+
+  struct Slot {
+    uint64_t key {kEmpty};
+    Arbiter* arbiter {nullptr};
+    bool touched {false};
+
+    bool IsLive() const { return key != kEmpty && key != kTombstone; }
+  };
+
+  static size_t CapacityFor(size_t count);
+  // Rebuild the table with room for 'count' arbiters, dropping the
+  // tombstones
+  void Rehash(size_t count);
+
+  Vector<Slot> slots_;
+  // Old slots while rehashing, kept to reuse its memory
+  Vector<Slot> scratch_;
+  size_t size_ {0};
+  size_t tombstones_ {0};
+};
+
+template <typename Evict>
+void ArbiterCache::Sweep(Evict&& evict) {
+  for (auto& slot : slots_) {
+    if (!slot.IsLive()) {
+      continue;
+    }
+    if (!slot.touched && evict(slot.arbiter)) {
+      slot.key = kTombstone;
+      slot.arbiter = nullptr;
+      --size_;
+      ++tombstones_;
+    }
+    slot.touched = false;
+  }
+}
+
+template <typename Copy>
+void ArbiterCache::CopyFrom(const ArbiterCache& other, Copy&& copy) {
+  slots_ = other.slots_;
+  for (auto& slot : slots_) {
+    if (slot.IsLive()) {
+      slot.arbiter = copy(slot.arbiter);
+    }
+  }
+  size_ = other.size_;
+  tombstones_ = other.tombstones_;
+}
+
+template <typename Func>
+void ArbiterCache::ForEachUsedSlot(Func&& func) const {
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    auto& slot = slots_[i];
+    if (slot.key != kEmpty) {
+      func(i, slot.key, static_cast<const Arbiter*>(slot.arbiter));
+    }
+  }
+}
+
+template <typename Index, typename Key, typename Live>
+bool ArbiterCache::ValidSlots(size_t capacity, size_t count, Index&& index,
+                              Key&& key, Live&& live) {
+  if (capacity == 0) {
+    return count == 0;
+  }
+  // Insert() keeps at least half of the slots empty
+  if (capacity < kMinCapacity || (capacity & (capacity - 1)) != 0 ||
+      count * 2 > capacity) {
+    return false;
+  }
+  Vector<uint64_t> keys(capacity, kEmpty);
+  for (size_t i = 0; i < count; ++i) {
+    size_t slot = index(i);
+    uint64_t value = key(i);
+    if (slot >= capacity || keys[slot] != kEmpty || value == kEmpty ||
+        (value != kTombstone && !live(i))) {
+      return false;
+    }
+    keys[slot] = value;
+  }
+  // Touch() probes from the hash and finds each key before any copy
+  auto mask = capacity - 1;
+  for (size_t i = 0; i < capacity; ++i) {
+    if (keys[i] == kEmpty || keys[i] == kTombstone) {
+      continue;
+    }
+    for (auto j = ArbiterKey(keys[i]).Hash() & mask; j != i; j = (j + 1) & mask) {
+      if (keys[j] == kEmpty || keys[j] == keys[i]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+template <typename Index, typename Key, typename Make>
+void ArbiterCache::Assign(size_t capacity, size_t count, Index&& index,
+                          Key&& key, Make&& arbiter) {
+  slots_.assign(capacity, Slot());
+  // The next rehash swaps in the scratch slots
+  scratch_.reserve(capacity);
+  size_ = 0;
+  tombstones_ = 0;
+  for (size_t i = 0; i < count; ++i) {
+    auto& slot = slots_[index(i)];
+    slot.key = key(i);
+    if (slot.key == kTombstone) {
+      ++tombstones_;
+      continue;
+    }
+    slot.arbiter = arbiter(i);
+    ++size_;
+  }
+}
+
+template <typename Func>
+void ArbiterCache::ForEach(Func&& func) const {
+  for (auto& slot : slots_) {
+    if (slot.IsLive()) {
+      func(*slot.arbiter);
+    }
+  }
+}
+
+}
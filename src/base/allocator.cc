@@ -0,0 +1,29 @@
+#include "allocator.h"
+
+namespace apollonia {
+
+static std::atomic<size_t> allocation_count {0};
+static thread_local AllocationScope* current_scope = nullptr;
+
+size_t AllocationCount() {
+  return allocation_count.load(std::memory_order_relaxed);
+}
+
+void CountAllocation() {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (current_scope != nullptr) {
+    current_scope->count_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+AllocationScope* AllocationScope::Current() {
+  return current_scope;
+}
+
+AllocationScope* AllocationScope::Enter(AllocationScope* scope) {
+  auto previous = current_scope;
+  current_scope = scope;
+  return previous;
+}
+
+}
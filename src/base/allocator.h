@@ -0,0 +1,66 @@
+#pragma once
+
+#include "apollonia.h"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace apollonia {
+
+// Number of heap allocations made by the engine's containers, pools and
+// arenas in the whole process.
+size_t AllocationCount();
+// Count an allocation in the process and in the current scope
+void CountAllocation();
+
+// Counts the engine's allocations on the thread creating it while it is
+// alive, including those of the pool workers running loops for that
+// thread. World::Step opens one, so the count of a step leaves out other
+// threads and other worlds. Scopes nest, an allocation is only counted by
+// the innermost.
+class AllocationScope {
+ public:
+  AllocationScope() : previous_(Enter(this)) {}
+  ~AllocationScope() { Enter(previous_); }
+  DISABLE_COPY_AND_ASSIGN(AllocationScope)
+
+  size_t count() const { return count_.load(std::memory_order_relaxed); }
+
+  // Scope of the calling thread, null if there is none
+  static AllocationScope* Current();
+  // Make 'scope' current on the calling thread, return the previous one
+  static AllocationScope* Enter(AllocationScope* scope);
+
+ private:
+  friend void CountAllocation();
+
+  std::atomic<size_t> count_ {0};
+  AllocationScope* previous_;
+};
+
+template <typename T>
+struct CountingAllocator {
+  using value_type = T;
+
+  CountingAllocator() {}
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    CountAllocation();
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T* p, size_t n) {
+    std::allocator<T>().deallocate(p, n);
+  }
+  template <typename U>
+  bool operator==(const CountingAllocator<U>&) const { return true; }
+  template <typename U>
+  bool operator!=(const CountingAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using Vector = std::vector<T, CountingAllocator<T>>;
+
+}
@@ -0,0 +1,44 @@
+#include "arena.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <new>
+
+namespace apollonia {
+
+// Bound by reference in std::max
+const size_t Arena::kMinBlockSize;
+
+Arena::~Arena() {
+  for (auto& block : blocks_) {
+    ::operator delete(block.data);
+  }
+}
+
+void* Arena::Allocate(size_t size, size_t align) {
+  assert(align <= alignof(std::max_align_t) && (align & (align - 1)) == 0);
+  for (; current_ < blocks_.size(); ++current_, offset_ = 0) {
+    auto& block = blocks_[current_];
+    auto begin = (offset_ + align - 1) & ~(align - 1);
+    if (begin + size <= block.size) {
+      offset_ = begin + size;
+      return block.data + begin;
+    }
+  }
+  CountAllocation();
+  auto block_size = std::max(kMinBlockSize, size);
+  if (!blocks_.empty()) {
+    block_size = std::max(block_size, blocks_.back().size * 2);
+  }
+  blocks_.push_back({static_cast<char*>(::operator new(block_size)), block_size});
+  current_ = blocks_.size() - 1;
+  offset_ = size;
+  return blocks_.back().data;
+}
+
+void Arena::Reset() {
+  current_ = 0;
+  offset_ = 0;
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "apollonia.h"
+#include "allocator.h"
+#include <cstddef>
+
+namespace apollonia {
+
+// Bump allocator for data that lives until the arena is reset. Reset
+// keeps the blocks, so refilling an arena to its old size is free.
+class Arena {
+ public:
+  Arena() {}
+  ~Arena();
+  DISABLE_COPY_AND_ASSIGN(Arena)
+
+  void* Allocate(size_t size, size_t align=alignof(std::max_align_t));
+  template <typename T>
+  T* Allocate(size_t count) {
+    return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+  }
+  void Reset();
+
+ private:
+  struct Block {
+    char* data;
+    size_t size;
+  };
+  static const size_t kMinBlockSize = 64 * 1024;
+
+  Vector<Block> blocks_;
+  // Block being filled and the offset in it
+  size_t current_ {0};
+  size_t offset_ {0};
+};
+
+}
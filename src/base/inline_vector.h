@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <initializer_list>
+
+namespace apollonia {
+
+// Vector of at most 'N' elements stored in place, it never allocates
+template <typename T, size_t N>
+class InlineVector {
+ public:
+  InlineVector() {}
+  InlineVector(std::initializer_list<T> list) {
+    for (auto& value : list) {
+      push_back(value);
+    }
+  }
+
+  static constexpr size_t capacity() { return N; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  T& operator[](size_t idx) {
+    assert(idx < size_);
+    return data_[idx];
+  }
+  const T& operator[](size_t idx) const {
+    assert(idx < size_);
+    return data_[idx];
+  }
+  T* begin() { return data_.data(); }
+  T* end() { return data_.data() + size_; }
+  const T* begin() const { return data_.data(); }
+  const T* end() const { return data_.data() + size_; }
+
+  void push_back(const T& value) {
+    assert(size_ < N);
+    data_[size_++] = value;
+  }
+  void clear() { size_ = 0; }
+
+ private:
+  std::array<T, N> data_;
+  size_t size_ {0};
+};
+
+}
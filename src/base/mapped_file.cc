@@ -0,0 +1,81 @@
+#include "mapped_file.h"
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace apollonia {
+
+#ifndef _WIN32
+
+bool MappedFile::Open(const char* path) {
+  Close();
+  auto fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+  auto size = static_cast<size_t>(st.st_size);
+  auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file referenced
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  data_ = static_cast<const char*>(data);
+  size_ = size;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
+
+#else
+
+bool MappedFile::Open(const char* path) {
+  Close();
+  auto file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  auto size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (size > 0) {
+    buffer_.resize(size);
+    if (fread(buffer_.data(), 1, size, file) != buffer_.size()) {
+      buffer_.clear();
+    }
+  }
+  fclose(file);
+  if (buffer_.empty()) {
+    return false;
+  }
+  data_ = buffer_.data();
+  size_ = buffer_.size();
+  return true;
+}
+
+void MappedFile::Close() {
+  buffer_.clear();
+  buffer_.shrink_to_fit();
+  data_ = nullptr;
+  size_ = 0;
+}
+
+#endif
+
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "apollonia.h"
+#include <cstddef>
+#include <vector>
+
+namespace apollonia {
+
+// Read only view of a whole file. It is mapped where mmap is available,
+// elsewhere it is read into memory. The data is aligned for any type.
+class MappedFile {
+ public:
+  MappedFile() {}
+  ~MappedFile() { Close(); }
+  DISABLE_COPY_AND_ASSIGN(MappedFile)
+
+  // Return false if the file can not be opened or is empty
+  bool Open(const char* path);
+  void Close();
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_ {nullptr};
+  size_t size_ {0};
+#ifdef _WIN32
+  std::vector<char> buffer_;
+#endif
+};
+
+}
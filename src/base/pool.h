@@ -0,0 +1,82 @@
+#pragma once
+
+#include "apollonia.h"
+#include "allocator.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <new>
+
+namespace apollonia {
+
+// Fixed size slots for objects of type 'T', carved from blocks that are
+// only released with the pool. Freed slots are recycled before any new
+// block is requested.
+template <typename T>
+class ObjectPool {
+ public:
+  ObjectPool() {}
+  ~ObjectPool() {
+    for (auto block : blocks_) {
+      ::operator delete(block);
+    }
+  }
+  DISABLE_COPY_AND_ASSIGN(ObjectPool)
+
+  // Raw storage for one 'T', the caller constructs it in place
+  void* Allocate() {
+    if (free_list_ != nullptr) {
+      auto slot = free_list_;
+      free_list_ = slot->next;
+      return slot;
+    }
+    if (used_ == block_size_) {
+      NewBlock();
+    }
+    return blocks_.back() + (used_++) * kSlotSize;
+  }
+  // Make sure the next 'count' allocations take no new block
+  void Reserve(size_t count) {
+    if (block_size_ - used_ < count) {
+      NewBlock(count);
+    }
+  }
+  // Give back the storage of an object already destructed
+  void Free(void* ptr) {
+    auto slot = static_cast<Slot*>(ptr);
+    slot->next = free_list_;
+    free_list_ = slot;
+  }
+
+ private:
+  union Slot {
+    Slot* next;
+    alignas(T) char storage[sizeof(T)];
+  };
+  static constexpr size_t kSlotSize = sizeof(Slot);
+  static const size_t kMinBlockSize = 64;
+
+  // Blocks double in size up to a limit
+  static size_t BlockSize(size_t idx) {
+    return kMinBlockSize << std::min<size_t>(idx, 10);
+  }
+
+  void NewBlock(size_t min_size=0) {
+    // Slots left in the last block are recycled
+    for (auto i = used_; i < block_size_; ++i) {
+      Free(blocks_.back() + i * kSlotSize);
+    }
+    CountAllocation();
+    block_size_ = std::max(BlockSize(blocks_.size()), min_size);
+    blocks_.push_back(static_cast<char*>(::operator new(block_size_ * kSlotSize)));
+    used_ = 0;
+  }
+
+  Vector<char*> blocks_;
+  size_t block_size_ {0};
+  // Slots handed out from the last block
+  size_t used_ {0};
+  Slot* free_list_ {nullptr};
+};
+
+}
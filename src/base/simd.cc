@@ -0,0 +1,32 @@
+#include "simd.h"
+
+namespace apollonia {
+
+SimdLevel DetectSimdLevel() {
+#if defined(APOLLONIA_X86) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return SimdLevel::kAvx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return SimdLevel::kSse2;
+  }
+#elif defined(APOLLONIA_X86)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] >= 7) {
+    __cpuidex(info, 7, 0);
+    // The OS must also save the ymm registers
+    int features[4];
+    __cpuid(features, 1);
+    bool os_avx = (features[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+    if (os_avx && (info[1] & (1 << 5))) {
+      return SimdLevel::kAvx2;
+    }
+  }
+  return SimdLevel::kSse2;
+#endif
+  return SimdLevel::kScalar;
+}
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define APOLLONIA_X86 1
+#include <immintrin.h>
+#define APOLLONIA_TARGET(isa) __attribute__((target(isa)))
+#elif defined(_M_X64)
+#define APOLLONIA_X86 1
+#include <intrin.h>
+#include <immintrin.h>
+#define APOLLONIA_TARGET(isa)
+#endif
+
+namespace apollonia {
+
+// Instruction sets of the kernels picked at runtime. The files defining
+// kernels are built without floating point contraction, so every level
+// rounds the same way and gives bit identical results.
+enum class SimdLevel {
+  kScalar,
+  kSse2,
+  kAvx2,
+};
+
+// The best level supported by the running cpu
+SimdLevel DetectSimdLevel();
+
+}
@@ -0,0 +1,87 @@
+#include "thread_pool.h"
+#include "trace.h"
+#include <algorithm>
+
+namespace apollonia {
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  for (size_t i = 1; i < num_threads; ++i) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Run(size_t n, size_t grain, Task task, void* ctx) {
+  grain = std::max<size_t>(grain, 1);
+  if (workers_.empty() || n <= grain) {
+    for (size_t begin = 0; begin < n; begin += grain) {
+      task(ctx, begin, std::min(begin + grain, n));
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = task;
+    ctx_ = ctx;
+    scope_ = AllocationScope::Current();
+    n_ = n;
+    grain_ = grain;
+    next_ = 0;
+    active_ = workers_.size();
+    ++generation_;
+  }
+  start_cv_.notify_all();
+  Work();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return active_ == 0; });
+}
+
+void ThreadPool::WorkerLoop() {
+  SetTraceThreadName("worker");
+  size_t generation = 0;
+  while (true) {
+    AllocationScope* scope = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_cv_.wait(lock, [&] { return stop_ || generation_ != generation; });
+      if (stop_) {
+        return;
+      }
+      generation = generation_;
+      scope = scope_;
+    }
+    auto previous = AllocationScope::Enter(scope);
+    Work();
+    AllocationScope::Enter(previous);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--active_ == 0) {
+      done_cv_.notify_one();
+    }
+  }
+}
+
+// Claim chunks until the loop runs out of them
+void ThreadPool::Work() {
+  APOLLONIA_TRACE_SCOPE("ParallelFor");
+  while (true) {
+    auto begin = next_.fetch_add(grain_);
+    if (begin >= n_) {
+      return;
+    }
+    task_(ctx_, begin, std::min(begin + grain_, n_));
+  }
+}
+
+}
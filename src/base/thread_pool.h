@@ -0,0 +1,65 @@
+#pragma once
+
+#include "apollonia.h"
+#include "allocator.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace apollonia {
+
+// A fixed set of workers running data parallel loops. The calling thread
+// takes part in every loop, so a pool of 1 thread runs everything inline.
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t num_threads=DefaultNumThreads());
+  ~ThreadPool();
+  DISABLE_COPY_AND_ASSIGN(ThreadPool)
+
+  static size_t DefaultNumThreads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  size_t num_threads() const { return workers_.size() + 1; }
+
+  // Split [0, n) into chunks of at most 'grain' items and call
+  // 'func(begin, end)' on each of them. Block until all chunks are done.
+  template <typename Func>
+  void ParallelFor(size_t n, size_t grain, Func&& func) {
+    using F = typename std::remove_reference<Func>::type;
+    Run(n, grain, [](void* ctx, size_t begin, size_t end) {
+      (*static_cast<F*>(ctx))(begin, end);
+    }, const_cast<void*>(static_cast<const void*>(&func)));
+  }
+
+ private:
+  using Task = void (*)(void* ctx, size_t begin, size_t end);
+
+  void Run(size_t n, size_t grain, Task task, void* ctx);
+  void WorkerLoop();
+  void Work();
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  size_t generation_ {0};
+  size_t active_ {0};
+  bool stop_ {false};
+
+  // The loop being run
+  Task task_ {nullptr};
+  void* ctx_ {nullptr};
+  // Allocation scope of the calling thread, the workers count into it
+  AllocationScope* scope_ {nullptr};
+  size_t n_ {0};
+  size_t grain_ {1};
+  std::atomic<size_t> next_ {0};
+};
+
+}
@@ -0,0 +1,136 @@
+#include "trace.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace apollonia {
+
+static_assert((kTraceCapacity & (kTraceCapacity - 1)) == 0,
+              "The capacity is a power of two");
+
+namespace {
+
+struct TraceEvent {
+  const char* name;
+  uint64_t begin_ns;
+  uint64_t end_ns;
+};
+
+// Written by its thread only, read by WriteChromeTrace()
+struct TraceRing {
+  std::atomic<uint64_t> head {0};
+  size_t tid {0};
+  std::string name;
+  TraceEvent events[kTraceCapacity];
+};
+
+// The rings outlive their threads so a trace can be written after a
+// pool is gone
+struct TraceRegistry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<TraceRing>> rings;
+};
+
+}
+
+static std::atomic<bool> tracing {false};
+
+static TraceRegistry& Registry() {
+  static TraceRegistry registry;
+  return registry;
+}
+
+// The ring of the calling thread, registered on first use
+static TraceRing& ThreadRing() {
+  thread_local TraceRing* ring = nullptr;
+  if (ring == nullptr) {
+    auto& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.rings.emplace_back(new TraceRing());
+    ring = registry.rings.back().get();
+    ring->tid = registry.rings.size();
+  }
+  return *ring;
+}
+
+static uint64_t NowNs() {
+  using namespace std::chrono;
+  static const auto epoch = steady_clock::now();
+  return duration_cast<nanoseconds>(steady_clock::now() - epoch).count();
+}
+
+void StartTrace() {
+  auto& registry = Registry();
+  {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (auto& ring : registry.rings) {
+      ring->head.store(0, std::memory_order_relaxed);
+    }
+  }
+  tracing.store(true, std::memory_order_release);
+}
+
+void StopTrace() {
+  tracing.store(false, std::memory_order_release);
+}
+
+bool IsTracing() {
+  return tracing.load(std::memory_order_relaxed);
+}
+
+void SetTraceThreadName(const char* name) {
+  auto& ring = ThreadRing();
+  std::lock_guard<std::mutex> lock(Registry().mutex);
+  ring.name = name;
+}
+
+TraceScope::TraceScope(const char* name)
+    : name_(name), active_(IsTracing()), begin_ns_(active_ ? NowNs() : 0) {}
+
+TraceScope::~TraceScope() {
+  if (!active_ || !IsTracing()) {
+    return;
+  }
+  auto& ring = ThreadRing();
+  auto head = ring.head.load(std::memory_order_relaxed);
+  ring.events[head & (kTraceCapacity - 1)] = {name_, begin_ns_, NowNs()};
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+bool WriteChromeTrace(const char* path) {
+  auto file = fopen(path, "w");
+  if (file == nullptr) {
+    return false;
+  }
+  auto& registry = Registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  fprintf(file, "{\"traceEvents\": [\n");
+  bool first = true;
+  for (auto& ring : registry.rings) {
+    if (!ring->name.empty()) {
+      fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+              "\"tid\": %zu, \"args\": {\"name\": \"%s\"}}",
+              first ? "" : ",\n", ring->tid, ring->name.c_str());
+      first = false;
+    }
+    auto head = ring->head.load(std::memory_order_acquire);
+    auto begin = head > kTraceCapacity ? head - kTraceCapacity : 0;
+    for (auto i = begin; i < head; ++i) {
+      auto& event = ring->events[i & (kTraceCapacity - 1)];
+      // Microseconds
+      fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, "
+              "\"ts\": %.3f, \"dur\": %.3f}",
+              first ? "" : ",\n", event.name, ring->tid,
+              event.begin_ns / 1000.0, (event.end_ns - event.begin_ns) / 1000.0);
+      first = false;
+    }
+  }
+  fprintf(file, "\n]}\n");
+  return fclose(file) == 0;
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "apollonia.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace apollonia {
+
+// Timeline of named spans on every thread, written as Chrome trace JSON
+// for chrome://tracing or Perfetto. Each thread records into its own ring
+// of the last kTraceCapacity spans without locking, older spans are
+// overwritten.
+//
+// The spans are compiled in only with APOLLONIA_TRACE, the functions
+// below are always available.
+static const size_t kTraceCapacity = 1 << 16;
+
+// Start recording, dropping the spans recorded before. Like writing, it
+// must not race with the traced threads.
+void StartTrace();
+void StopTrace();
+bool IsTracing();
+// Name the calling thread in the trace
+void SetTraceThreadName(const char* name);
+// Write the spans of all threads, return false if the file can not be
+// written. Call it while the traced threads are idle, e.g. after
+// StopTrace() or between steps.
+bool WriteChromeTrace(const char* path);
+
+// Record the enclosing scope as a span, 'name' must outlive the trace
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name);
+  ~TraceScope();
+  DISABLE_COPY_AND_ASSIGN(TraceScope)
+
+ private:
+  const char* name_;
+  bool active_;
+  uint64_t begin_ns_;
+};
+
+#ifdef APOLLONIA_TRACE
+#define APOLLONIA_TRACE_CONCAT2(a, b) a##b
+#define APOLLONIA_TRACE_CONCAT(a, b) APOLLONIA_TRACE_CONCAT2(a, b)
+#define APOLLONIA_TRACE_SCOPE(name) \
+  ::apollonia::TraceScope APOLLONIA_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define APOLLONIA_TRACE_SCOPE(name) ((void)0)
+#endif
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "apollonia.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace apollonia {
+
+// Hands values from one writer thread to one reader thread without locks.
+// The writer fills write_buffer() and publishes it, the reader takes the
+// latest published value. Neither side ever waits for the other, values
+// published faster than they are read are skipped.
+template <typename T>
+class TripleBuffer {
+ public:
+  TripleBuffer() {}
+  DISABLE_COPY_AND_ASSIGN(TripleBuffer)
+
+  // Owned by the writer until Publish()
+  T& write_buffer() { return buffers_[write_]; }
+  void Publish() {
+    write_ = middle_.exchange(write_ | kFresh, std::memory_order_acq_rel) & kIndexMask;
+  }
+
+  // The latest published value, owned by the reader until the next Read()
+  const T& Read() {
+    if (middle_.load(std::memory_order_relaxed) & kFresh) {
+      read_ = middle_.exchange(read_, std::memory_order_acq_rel) & kIndexMask;
+    }
+    return buffers_[read_];
+  }
+
+ private:
+  // The buffer in the middle is tagged when it holds an unread value
+  static const uint8_t kIndexMask = 3;
+  static const uint8_t kFresh = 4;
+  static const size_t kCacheLine = 64;
+
+  T buffers_[3];
+  // The indices of the two sides are kept a cache line apart by padding,
+  // aligning them would over-align the class holding the buffer
+  char pad0_[kCacheLine];
+  uint8_t write_ {0};
+  char pad1_[kCacheLine - sizeof(uint8_t)];
+  uint8_t read_ {1};
+  char pad2_[kCacheLine - sizeof(uint8_t)];
+  std::atomic<uint8_t> middle_ {2};
+  char pad3_[kCacheLine - sizeof(std::atomic<uint8_t>)];
+};
+
+}
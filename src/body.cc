@@ -1,4 +1,5 @@
 #include "body.h"
+#include "sat.h"
 #include <algorithm>
 
 namespace apollonia {
@@ -6,56 +7,57 @@ namespace apollonia {
 using std::abs;
 
 void Body::set_mass(Float mass) {
-  mass_ = mass;
-  inv_mass_ = 1 / mass;
+  SetMass(mass);
+  UpdateMass();
 }
 
-void Body::set_inertia(Float inertia) {
-  inertia_ = inertia;
-  inv_inertia_ = 1 / inertia;
-}
-
-bool Body::ShouldCollide(const Body& other) const {
-  return !(mass_ == kInf && other.mass_ == kInf);
+// Static bodies get exact zero inverse mass and inertia, so the solver
+// can not move them.
+void Body::SetMass(Float mass) {
+  auto is_static = mass == kInf;
+  if (is_static != (storage_.inv_mass[id_] == 0)) {
+    storage_.statics_changed = true;
+  }
+  storage_.mass[id_] = mass;
+  storage_.inv_mass[id_] = is_static ? 0 : 1 / mass;
+  if (is_static) {
+    storage_.Sleep(id_);
+  } else {
+    Wake();
+  }
 }
 
-void Body::ApplyImpulse(const Vec2& impulse, const Vec2& r) {
-  velocity_ += impulse * inv_mass_;
-  angular_velocity_ += inv_inertia_ * Cross(r, impulse);
+void Body::set_inertia(Float inertia) {
+  storage_.inertia[id_] = inertia;
+  storage_.inv_inertia[id_] = inertia >= kInf ? 0 : 1 / inertia;
 }
 
-void Body::Integrate(const Vec2& gravity, Float dt) {
-  if (mass_ == kInf) {
-    return;
-  }
-  velocity_ += (gravity + force_ * inv_mass_) * dt;
-  angular_velocity_ += (torque_ * inv_inertia_) * dt;
-  position_ += velocity_ * dt;
-  rotation_ = Mat22(angular_velocity_ * dt) * rotation_;
+bool Body::ShouldCollide(const Body& other) const {
+  return !(mass() == kInf && other.mass() == kInf);
 }
 
-static Float PolygonArea(const std::vector<Vec2>& vertices) {
+static Float PolygonArea(const Vec2* vertices, size_t count) {
   Float area = 0;
-  for (size_t i = 0; i < vertices.size(); ++i) {
-    auto j = (i+1) % vertices.size();
+  for (size_t i = 0; i < count; ++i) {
+    auto j = (i+1) % count;
     area += Cross(vertices[i], vertices[j]);
   }
   return area / 2;
 }
 
-static Vec2 PolygonCentroid(const std::vector<Vec2>& vertices) {
+static Vec2 PolygonCentroid(const Vec2* vertices, size_t count) {
   Vec2 gc {0, 0};
-  for (size_t i = 0; i < vertices.size(); ++i) {
-    auto j = (i+1) % vertices.size();
+  for (size_t i = 0; i < count; ++i) {
+    auto j = (i+1) % count;
     gc += (vertices[i] + vertices[j]) * Cross(vertices[i], vertices[j]);
   }
-  return gc / 6 / PolygonArea(vertices);
+  return gc / 6 / PolygonArea(vertices, count);
 }
 
-static Float PolygonInertia(Float mass, const PolygonBody::VertexList& vertices) {
+static Float PolygonInertia(Float mass, const Vec2* vertices, size_t count) {
   Float acc0 = 0, acc1 = 0;
-  for (size_t i = 0; i < vertices.size(); ++i) {
-    auto a = vertices[i], b = vertices[(i+1)%vertices.size()];
+  for (size_t i = 0; i < count; ++i) {
+    auto a = vertices[i], b = vertices[(i+1)%count];
     auto cross = abs(Cross(a, b));
     acc0 += cross * (Dot(a, a) + Dot(b, b) + Dot(a, b));
     acc1 += cross;
@@ -63,28 +65,145 @@ static Float PolygonInertia(Float mass, const PolygonBody::VertexList& vertices)
   return mass * acc0 / 6 / acc1;
 }
 
-PolygonBody::PolygonBody(Float mass, const VertexList& vertices)
-    : Body(mass), vertices_(vertices) {
-  set_inertia(PolygonInertia(mass, vertices));
-  set_centroid(PolygonCentroid(vertices));
+PolygonBody::PolygonBody(BodyStorage& storage, Float mass,
+                         const Vec2* vertices, size_t count, bool init)
+    : Body(storage, ShapeType::kPolygon, mass), vertices_(vertices), count_(count),
+      offset_(storage.AddVertices(count)) {
+  if (init) {
+    UpdateMass();
+    Synchronize();
+  }
+}
+
+void PolygonBody::UpdateMass() {
+  auto mass = this->mass();
+  set_inertia(mass == kInf ? kInf : PolygonInertia(mass, vertices_, count_));
+  set_centroid(PolygonCentroid(vertices_, count_));
 }
 
-Float PolygonBody::FindMinSeparatingAxis(size_t& idx, const PolygonBody& other) const {
-  Float separation = -kInf;
-  for (size_t i = 0; i < this->Count(); ++i) {
-    auto va = this->LocalToWorld((*this)[i]);
-    auto normal = this->EdgeAt(i).Normal();
-    auto min_sep = kInf;
-    for (size_t j = 0; j < other.Count(); ++j) {
-      auto vb = other.LocalToWorld(other[j]);
-      min_sep = std::min(min_sep, Dot(vb - va, normal));
+void PolygonBody::Synchronize() {
+  auto& storage = this->storage();
+  auto vertices = &storage.world_vertices[offset_];
+  auto normals = &storage.world_normals[offset_];
+  auto xs = &storage.world_x[offset_];
+  auto ys = &storage.world_y[offset_];
+  // Rotated vertices, the normals are taken before the translation
+  auto first = (*this)[0];
+  auto v0 = first;
+  for (size_t i = 0; i < count_; ++i) {
+    auto v1 = i + 1 < count_ ? (*this)[i+1] : first;
+    vertices[i] = LocalToWorld(v0);
+    normals[i] = (v1 - v0).Normal();
+    xs[i] = vertices[i].x;
+    ys[i] = vertices[i].y;
+    v0 = v1;
+  }
+}
+
+AABB PolygonBody::Bound() const {
+  auto vertices = world_vertices();
+  AABB aabb(vertices[0], vertices[0]);
+  for (size_t i = 1; i < Count(); ++i) {
+    auto& v = vertices[i];
+    aabb.lower = {std::min(aabb.lower.x, v.x), std::min(aabb.lower.y, v.y)};
+    aabb.upper = {std::max(aabb.upper.x, v.x), std::max(aabb.upper.y, v.y)};
+  }
+  return aabb;
+}
+
+// Clip the ray by the half planes of the edges, it enters through the
+// edge clipping it last
+bool PolygonBody::RayCast(const Ray& ray, Float max_fraction, RayHit& hit) const {
+  auto vertices = world_vertices();
+  auto normals = world_normals();
+  auto d = ray.p2 - ray.p1;
+  Float lower = 0, upper = max_fraction;
+  size_t index = Count();
+  for (size_t i = 0; i < Count(); ++i) {
+    auto numerator = Dot(normals[i], vertices[i] - ray.p1);
+    auto denominator = Dot(normals[i], d);
+    if (denominator == 0) {
+      // Parallel to the edge and outside of it
+      if (numerator < 0) {
+        return false;
+      }
+    } else if (denominator < 0 && numerator < lower * denominator) {
+      lower = numerator / denominator;
+      index = i;
+    } else if (denominator > 0 && numerator < upper * denominator) {
+      upper = numerator / denominator;
+    }
+    if (upper < lower) {
+      return false;
     }
-    if (min_sep > separation) {
-      separation = min_sep;
-      idx = i;
+  }
+  if (index == Count()) {
+    return false;
+  }
+  hit.point = ray.p1 + d * lower;
+  hit.normal = normals[index];
+  hit.fraction = lower;
+  return true;
+}
+
+bool PolygonBody::Contains(const Vec2& point) const {
+  auto vertices = world_vertices();
+  auto normals = world_normals();
+  for (size_t i = 0; i < Count(); ++i) {
+    if (Dot(normals[i], point - vertices[i]) > 0) {
+      return false;
     }
   }
-  return separation;
+  return true;
+}
+
+Float PolygonBody::FindMinSeparatingAxis(size_t& idx, const PolygonBody& other) const {
+  return FindMaxSeparation(world_vertices(), world_normals(), Count(),
+                           other.world_x(), other.world_y(), other.Count(), idx);
+}
+
+CircleBody::CircleBody(BodyStorage& storage, Float mass, Float radius)
+    : Body(storage, ShapeType::kCircle, mass), radius_(radius) {
+  UpdateMass();
+}
+
+void CircleBody::UpdateMass() {
+  auto mass = this->mass();
+  set_inertia(mass == kInf ? kInf : mass * radius_ * radius_ / 2);
+}
+
+AABB CircleBody::Bound() const {
+  Vec2 extent {radius_, radius_};
+  return AABB(center() - extent, center() + extent);
+}
+
+// Solve |p1 + d * t - center| = radius for the smaller root
+bool CircleBody::RayCast(const Ray& ray, Float max_fraction, RayHit& hit) const {
+  auto s = ray.p1 - center();
+  auto b = Dot(s, s) - radius_ * radius_;
+  if (b < 0) {
+    return false;
+  }
+  auto d = ray.p2 - ray.p1;
+  auto c = Dot(s, d);
+  auto rr = Dot(d, d);
+  auto sigma = c * c - rr * b;
+  if (sigma < 0 || rr == 0) {
+    return false;
+  }
+  auto a = -(c + sqrt(sigma));
+  if (a < 0 || a > max_fraction * rr) {
+    return false;
+  }
+  hit.fraction = a / rr;
+  hit.point = ray.p1 + d * hit.fraction;
+  hit.normal = (hit.point - center()).Normalized();
+  return true;
+}
+
+bool CircleBody::Contains(const Vec2& point) const {
+  auto d = point - center();
+  return Dot(d, d) <= radius_ * radius_;
 }
 
 }
@@ -2,84 +2,166 @@
 
 #include "apollonia.h"
 #include "base/math.h"
+#include "body_storage.h"
+#include "broad_phase.h"
 #include <vector>
 
 namespace apollonia {
 
 class World;
+class Body;
 struct Contact;
 
+// The segment from 'p1' to 'p2'
+struct Ray {
+  Vec2 p1;
+  Vec2 p2;
+};
+
+// Where a ray enters a body, at p1 + (p2 - p1) * fraction
+struct RayHit {
+  Body* body {nullptr};
+  Vec2 point;
+  // Outward normal of the surface
+  Vec2 normal;
+  Float fraction {1};
+};
+
+// Tag of the concrete shape, the narrow phase dispatches on pairs of them
+enum class ShapeType : uint8_t {
+  kPolygon,
+  kCircle,
+};
+static const size_t kNumShapeTypes = 2;
+
+// A body is a handle to its state in the world's BodyStorage plus the
+// shape, which is kept by the subclasses.
 class Body {
  public:
   friend class World;
+  friend struct BodyStorage;
   using VertexList = std::vector<Vec2>;
 
+  ShapeType shape_type() const { return shape_type_; }
   bool ShouldCollide(const Body& other) const;
-  void ApplyImpulse(const Vec2& impulse, const Vec2& r);
-  void Integrate(const Vec2& gravity, Float dt);
+  void ApplyImpulse(const Vec2& impulse, const Vec2& r) {
+    storage_.ApplyImpulse(id_, impulse, r);
+  }
 
   // Convert local point to world
   Vec2 LocalToWorld(const Vec2& local_point) const {
-    return position_ + local_point;
+    return position() + local_point;
   }
 
-  Float mass() const { return mass_; }
-  Float inv_mass() const { return inv_mass_; }
+  // Index of the state in the world's storage, it is stable once the
+  // body is added to the world.
+  BodyId id() const { return id_; }
+
+  Float mass() const { return storage_.mass[id_]; }
+  Float inv_mass() const { return storage_.inv_mass[id_]; }
+  // Also refreshes the inertia from the shape. A body turned static stops
+  // and sleeps, the world picks up the change on the next step.
   void set_mass(Float mass);
 
-  Float inertia() const { return inertia_; }
-  Float inv_inertia() const { return inv_inertia_; }
+  Float inertia() const { return storage_.inertia[id_]; }
+  Float inv_inertia() const { return storage_.inv_inertia[id_]; }
   void set_inertia(Float inertia);
 
-  const Vec2& centroid() const { return centroid_; }
+  const Vec2& centroid() const { return storage_.centroid[id_]; }
+
+  // A sleeping body is skipped by the step until it is touched by an awake
+  // body, its island is woken or one of the setters below is called.
+  bool awake() const { return storage_.awake[id_] != 0; }
+  void Wake() { storage_.Wake(id_); }
+
+  const Vec2& position() const { return storage_.position[id_]; }
+  void set_position(const Vec2& position) {
+    storage_.position[id_] = position;
+    Synchronize();
+    Wake();
+  }
+
+  const Rot& rotation() const { return storage_.rotation[id_]; }
+  void set_rotation(const Rot& rotation) {
+    storage_.rotation[id_] = rotation;
+    Synchronize();
+    Wake();
+  }
+  void set_rotation(Float angle) { set_rotation(Rot(angle)); }
 
-  const Vec2& position() const { return position_; }
-  void set_position(const Vec2& position) { position_ = position; }
+  const Vec2& velocity() const { return storage_.velocity[id_]; }
+  void set_velocity(const Vec2& velocity) {
+    storage_.velocity[id_] = velocity;
+    Wake();
+  }
 
-  const Mat22& rotation() const { return rotation_; }
-  void set_rotation(const Mat22& rotation) { rotation_ = rotation; }
-  void set_rotation(Float angle) { set_rotation(Mat22(angle)); }
+  Float angular_velocity() const { return storage_.angular_velocity[id_]; }
+  void set_angular_velocity(Float angular_velocity) {
+    storage_.angular_velocity[id_] = angular_velocity;
+    Wake();
+  }
 
-  const Vec2& velocity() const { return velocity_; }
-  void set_velocity(const Vec2& velocity) {velocity_ = velocity; }
+  const Vec2& force() const { return storage_.force[id_]; }
+  void set_force(const Vec2& force) {
+    storage_.force[id_] = force;
+    Wake();
+  }
 
-  Float angular_velocity() const { return angular_velocity_; }
-  void set_angular_velocity(Float angular_velocity) { angular_velocity_ = angular_velocity; }
+  Float torque() const { return storage_.torque[id_]; }
+  void set_torque(Float torque) {
+    storage_.torque[id_] = torque;
+    Wake();
+  }
 
-  const Vec2& force() const { return force_; }
-  void set_force(const Vec2& force) { force_ = force; }
+  Float friction() const { return storage_.friction[id_]; }
+  void set_friction(Float friction) { storage_.friction[id_] = friction; }
 
-  Float torque() const { return torque_; }
-  void set_torque(Float torque) { torque_ = torque; }
+  Float bounce() const { return storage_.bounce[id_]; }
+  void set_bounce(Float bounce) { storage_.bounce[id_] = bounce; }
 
-  Float friction() const { return friction_; }
-  void set_friction(Float friction) { friction_ = friction; }
+  // A bullet polygon is swept against the static polygons every sub-step
+  // and stopped at the first contact, so it does not tunnel through thin
+  // walls at large time steps. Only static polygons stop it, a bullet
+  // still tunnels through thin dynamic bodies and static circles. Bullet
+  // circles are not swept. Off by default, the sweep costs a time of
+  // impact solve per nearby static body.
+  bool bullet() const { return storage_.bullet[id_] != 0; }
+  void set_bullet(bool bullet) { storage_.bullet[id_] = bullet; }
 
-  Float bounce() const { return bounce_; }
-  void set_bounce(Float bounce) { bounce_ = bounce; }
+  // World space bounding box of the shape
+  virtual AABB Bound() const = 0;
+  // Fill 'hit' if the ray enters the shape before 'max_fraction'. A ray
+  // starting inside does not hit it.
+  virtual bool RayCast(const Ray& ray, Float max_fraction, RayHit& hit) const = 0;
+  virtual bool Contains(const Vec2& point) const = 0;
 
  protected:
-  Body(Float mass) { set_mass(mass); }
+  Body(BodyStorage& storage, ShapeType shape_type, Float mass)
+      : storage_(storage), id_(storage.Add(this)), shape_type_(shape_type) {
+    SetMass(mass);
+  }
   virtual ~Body() {}
   DISABLE_COPY_AND_ASSIGN(Body)
 
   // Centroid is determined by shape of the body.
-  void set_centroid(const Vec2& centroid) { centroid_ = centroid; }
+  void set_centroid(const Vec2& centroid) { storage_.centroid[id_] = centroid; }
+  BodyStorage& storage() const { return storage_; }
+  // Refresh the inertia and centroid from the mass and the shape
+  virtual void UpdateMass() {}
+  // Refresh the shape data derived from the transform
+  virtual void Synchronize() {}
 
  private:
-  Float mass_;
-  Float inv_mass_;
-  Float inertia_;
-  Float inv_inertia_;
-  Vec2  centroid_         {0, 0};
-  Vec2  position_         {0, 0};
-  Mat22 rotation_         {Mat22::I};
-  Vec2  velocity_         {0, 0};
-  Float angular_velocity_ {0};
-  Vec2  force_            {0, 0};
-  Float torque_           {0};
-  Float friction_         {1};
-  Float bounce_           {0};
+  // set_mass() without UpdateMass(), the shape is not built yet
+  void SetMass(Float mass);
+
+  BodyStorage& storage_;
+  BodyId id_;
+  ShapeType shape_type_;
+  // Tight bounding box computed by the last broad phase
+  AABB  aabb_;
+  // Leaf of the body in the broad phase tree
+  int   proxy_ {AABBTree::kNullNode};
 };
 
 class PolygonBody : public Body {
@@ -87,7 +169,7 @@ class PolygonBody : public Body {
   friend class World;
   using VertexList = std::vector<Vec2>;
 
-  size_t Count() const { return vertices_.size(); }
+  size_t Count() const { return count_; }
 
   // Get local vertices with rotation
   Vec2 operator[](size_t idx) const {
@@ -97,23 +179,56 @@ class PolygonBody : public Body {
     return (*this)[(idx+1)%Count()] - (*this)[idx];
   }
 
+  // World space vertices and edge normals, cached at the end of each step
+  // and whenever the transform is set. Edge 'i' goes from vertex 'i' to
+  // vertex 'i+1'.
+  const Vec2* world_vertices() const { return &storage().world_vertices[offset_]; }
+  const Vec2* world_normals() const { return &storage().world_normals[offset_]; }
+  const Float* world_x() const { return &storage().world_x[offset_]; }
+  const Float* world_y() const { return &storage().world_y[offset_]; }
+  const Vec2& WorldVertex(size_t idx) const { return world_vertices()[idx]; }
+  const Vec2& WorldNormal(size_t idx) const { return world_normals()[idx]; }
+
   Float FindMinSeparatingAxis(size_t& idx, const PolygonBody& other) const;
+  AABB Bound() const override;
+  bool RayCast(const Ray& ray, Float max_fraction, RayHit& hit) const override;
+  bool Contains(const Vec2& point) const override;
 
  private:
-  PolygonBody(Float mass, const VertexList& vertices);
+  // The vertices are owned by the world. Without 'init' the mass
+  // properties and the world vertices are left to UpdateMass() and
+  // Synchronize(), so World::AddPolygons can run them in parallel.
+  PolygonBody(BodyStorage& storage, Float mass, const Vec2* vertices,
+              size_t count, bool init=true);
   DISABLE_COPY_AND_ASSIGN(PolygonBody)
 
-  VertexList vertices_;
+  // Inertia and centroid of the local vertices
+  void UpdateMass() override;
+  void Synchronize() override;
+
+  const Vec2* vertices_;
+  size_t count_;
+  // First vertex in the world space cache
+  size_t offset_;
 };
 
 class CircleBody : public Body {
  public:
   friend class World;
 
+  Float radius() const { return radius_; }
+  // The centroid of a circle is its position
+  const Vec2& center() const { return position(); }
+  AABB Bound() const override;
+  bool RayCast(const Ray& ray, Float max_fraction, RayHit& hit) const override;
+  bool Contains(const Vec2& point) const override;
+
  private:
-  CircleBody(Float mass, Float radius);
+  CircleBody(BodyStorage& storage, Float mass, Float radius);
   DISABLE_COPY_AND_ASSIGN(CircleBody)
 
+  void UpdateMass() override;
+
   Float radius_;
 };
 
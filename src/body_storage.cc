@@ -0,0 +1,110 @@
+#include "body_storage.h"
+#include "body.h"
+#include <utility>
+
+namespace apollonia {
+
+BodyId BodyStorage::Add(Body* owner) {
+  auto id = static_cast<BodyId>(size());
+  velocity.emplace_back(0, 0);
+  angular_velocity.push_back(0);
+  inv_mass.push_back(0);
+  inv_inertia.push_back(0);
+  awake.push_back(0);
+  position.emplace_back(0, 0);
+  rotation.emplace_back();
+  force.emplace_back(0, 0);
+  torque.push_back(0);
+  sleep_time.push_back(0);
+  mass.push_back(kInf);
+  inertia.push_back(kInf);
+  centroid.emplace_back(0, 0);
+  friction.push_back(1);
+  bounce.push_back(0);
+  bullet.push_back(0);
+  body.push_back(owner);
+  return id;
+}
+
+size_t BodyStorage::AddVertices(size_t count) {
+  auto offset = world_vertices.size();
+  world_vertices.resize(offset + count);
+  world_normals.resize(offset + count);
+  world_x.resize(offset + count);
+  world_y.resize(offset + count);
+  return offset;
+}
+
+void BodyStorage::Reserve(size_t bodies, size_t vertices) {
+  velocity.reserve(bodies);
+  angular_velocity.reserve(bodies);
+  inv_mass.reserve(bodies);
+  inv_inertia.reserve(bodies);
+  awake.reserve(bodies);
+  position.reserve(bodies);
+  rotation.reserve(bodies);
+  force.reserve(bodies);
+  torque.reserve(bodies);
+  sleep_time.reserve(bodies);
+  mass.reserve(bodies);
+  inertia.reserve(bodies);
+  centroid.reserve(bodies);
+  friction.reserve(bodies);
+  bounce.reserve(bodies);
+  bullet.reserve(bodies);
+  body.reserve(bodies);
+  world_vertices.reserve(vertices);
+  world_normals.reserve(vertices);
+  world_x.reserve(vertices);
+  world_y.reserve(vertices);
+}
+
+void BodyStorage::Swap(BodyId a, BodyId b) {
+  using std::swap;
+  swap(velocity[a], velocity[b]);
+  swap(angular_velocity[a], angular_velocity[b]);
+  swap(inv_mass[a], inv_mass[b]);
+  swap(inv_inertia[a], inv_inertia[b]);
+  swap(awake[a], awake[b]);
+  swap(position[a], position[b]);
+  swap(rotation[a], rotation[b]);
+  swap(force[a], force[b]);
+  swap(torque[a], torque[b]);
+  swap(sleep_time[a], sleep_time[b]);
+  swap(mass[a], mass[b]);
+  swap(inertia[a], inertia[b]);
+  swap(centroid[a], centroid[b]);
+  swap(friction[a], friction[b]);
+  swap(bounce[a], bounce[b]);
+  swap(bullet[a], bullet[b]);
+  swap(body[a], body[b]);
+  body[a]->id_ = a;
+  body[b]->id_ = b;
+}
+
+void BodyStorage::Clear() {
+  velocity.clear();
+  angular_velocity.clear();
+  inv_mass.clear();
+  inv_inertia.clear();
+  awake.clear();
+  position.clear();
+  rotation.clear();
+  force.clear();
+  torque.clear();
+  sleep_time.clear();
+  mass.clear();
+  inertia.clear();
+  centroid.clear();
+  friction.clear();
+  bounce.clear();
+  bullet.clear();
+  body.clear();
+  world_vertices.clear();
+  world_normals.clear();
+  world_x.clear();
+  world_y.clear();
+  statics_changed = false;
+}
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "apollonia.h"
+#include "base/allocator.h"
+#include "base/math.h"
+#include <cstdint>
+
+namespace apollonia {
+
+class Body;
+using BodyId = uint32_t;
+
+// State of all bodies in a world as structure of arrays, indexed by BodyId.
+// The solver streams through the hot arrays only, the cold ones are read
+// once per step or less.
+struct BodyStorage {
+  // Hot: read and written by every solver iteration
+  Vector<Vec2>  velocity;
+  Vector<Float> angular_velocity;
+  Vector<Float> inv_mass;
+  Vector<Float> inv_inertia;
+  // Zero for sleeping and static bodies, the solver skips them
+  Vector<uint8_t> awake;
+
+  // Warm: integrated once per step
+  Vector<Vec2>  position;
+  Vector<Rot>   rotation;
+  Vector<Vec2>  force;
+  Vector<Float> torque;
+  // Time the body has been resting, reset when a sleeping body is touched
+  Vector<Float> sleep_time;
+
+  // Cold: mass and material properties
+  Vector<Float> mass;
+  Vector<Float> inertia;
+  Vector<Vec2>  centroid;
+  Vector<Float> friction;
+  Vector<Float> bounce;
+  // Nonzero for bodies swept against static ones, see Body::set_bullet()
+  Vector<uint8_t> bullet;
+  Vector<Body*> body;
+  // Set when a body turns static or dynamic, the world refreshes what it
+  // keeps about the static bodies on the next step
+  bool statics_changed {false};
+
+  // Per polygon vertex, world space vertices and edge normals refreshed
+  // once per step. A polygon owns a contiguous range of them. The
+  // vertices are also kept as separate x and y streams for SIMD kernels.
+  Vector<Vec2>  world_vertices;
+  Vector<Vec2>  world_normals;
+  Vector<Float> world_x;
+  Vector<Float> world_y;
+
+  size_t size() const { return body.size(); }
+  // Append a body at rest, return its id
+  BodyId Add(Body* owner);
+  // Append 'count' vertices to the cache, return the offset of the first
+  size_t AddVertices(size_t count);
+  // Room for 'bodies' bodies and 'vertices' polygon vertices in total
+  void Reserve(size_t bodies, size_t vertices);
+  // Exchange the state of two bodies, the owners follow their state
+  void Swap(BodyId a, BodyId b);
+  void Clear();
+
+  // Static bodies never wake
+  void Wake(BodyId id) {
+    awake[id] = inv_mass[id] != 0;
+    sleep_time[id] = 0;
+  }
+  void Sleep(BodyId id) {
+    awake[id] = 0;
+    velocity[id] = {0, 0};
+    angular_velocity[id] = 0;
+  }
+
+  // Static bodies are shared by the islands solved concurrently, they are
+  // only read.
+  void ApplyImpulse(BodyId id, const Vec2& impulse, const Vec2& r) {
+    if (inv_mass[id] == 0) {
+      return;
+    }
+    velocity[id] += impulse * inv_mass[id];
+    angular_velocity[id] += inv_inertia[id] * Cross(r, impulse);
+  }
+  // Velocity of the point 'r' away from the centroid
+  Vec2 VelocityAt(BodyId id, const Vec2& r) const {
+    return velocity[id] + Cross(angular_velocity[id], r);
+  }
+};
+
+}
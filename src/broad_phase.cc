@@ -0,0 +1,301 @@
+#include "broad_phase.h"
+
+namespace apollonia {
+
+using std::abs;
+
+const int AABBTree::kNullNode;
+constexpr Float AABBTree::kMargin;
+
+int AABBTree::AllocateNode() {
+  if (free_list_ == kNullNode) {
+    nodes_.emplace_back();
+    return static_cast<int>(nodes_.size()) - 1;
+  }
+  auto node = free_list_;
+  free_list_ = nodes_[node].parent;
+  nodes_[node] = Node();
+  return node;
+}
+
+void AABBTree::FreeNode(int node) {
+  nodes_[node].parent = free_list_;
+  nodes_[node].height = -1;
+  free_list_ = node;
+}
+
+int AABBTree::CreateProxy(const AABB& aabb, void* user_data) {
+  auto proxy = AllocateNode();
+  nodes_[proxy].aabb = aabb.Expanded(kMargin);
+  nodes_[proxy].user_data = user_data;
+  nodes_[proxy].height = 0;
+  InsertLeaf(proxy);
+  return proxy;
+}
+
+void AABBTree::DestroyProxy(int proxy) {
+  assert(nodes_[proxy].IsLeaf());
+  RemoveLeaf(proxy);
+  FreeNode(proxy);
+}
+
+bool AABBTree::MoveProxy(int proxy, const AABB& aabb, const Vec2& displacement) {
+  assert(nodes_[proxy].IsLeaf());
+  if (nodes_[proxy].aabb.Contains(aabb)) {
+    return false;
+  }
+  RemoveLeaf(proxy);
+  auto fat = aabb.Expanded(kMargin);
+  // Predict the motion in the next few steps
+  static const Float kDisplacementMultiplier = 2;
+  auto d = kDisplacementMultiplier * displacement;
+  if (d.x < 0) {
+    fat.lower.x += d.x;
+  } else {
+    fat.upper.x += d.x;
+  }
+  if (d.y < 0) {
+    fat.lower.y += d.y;
+  } else {
+    fat.upper.y += d.y;
+  }
+  nodes_[proxy].aabb = fat;
+  InsertLeaf(proxy);
+  return true;
+}
+
+void AABBTree::CopyFrom(const AABBTree& other) {
+  nodes_ = other.nodes_;
+  root_ = other.root_;
+  free_list_ = other.free_list_;
+}
+
+void AABBTree::Clear() {
+  nodes_.clear();
+  root_ = kNullNode;
+  free_list_ = kNullNode;
+}
+
+void AABBTree::InsertLeaf(int leaf) {
+  if (root_ == kNullNode) {
+    root_ = leaf;
+    nodes_[root_].parent = kNullNode;
+    return;
+  }
+
+  // Find the best sibling by the perimeter of the enlarged tree
+  auto leaf_aabb = nodes_[leaf].aabb;
+  auto idx = root_;
+  while (!nodes_[idx].IsLeaf()) {
+    auto left = nodes_[idx].left;
+    auto right = nodes_[idx].right;
+    auto area = nodes_[idx].aabb.Perimeter();
+    auto combined_area = AABB::Union(nodes_[idx].aabb, leaf_aabb).Perimeter();
+    // Cost of creating a new parent for this node and the new leaf
+    auto cost = 2 * combined_area;
+    // Minimum cost of pushing the leaf further down the tree
+    auto inheritance_cost = 2 * (combined_area - area);
+
+    auto ChildCost = [&](int child) {
+      auto aabb = AABB::Union(leaf_aabb, nodes_[child].aabb);
+      if (nodes_[child].IsLeaf()) {
+        return aabb.Perimeter() + inheritance_cost;
+      }
+      return aabb.Perimeter() - nodes_[child].aabb.Perimeter() + inheritance_cost;
+    };
+    auto cost_left = ChildCost(left);
+    auto cost_right = ChildCost(right);
+    if (cost < cost_left && cost < cost_right) {
+      break;
+    }
+    idx = cost_left < cost_right ? left : right;
+  }
+
+  auto sibling = idx;
+  auto old_parent = nodes_[sibling].parent;
+  auto new_parent = AllocateNode();
+  nodes_[new_parent].parent = old_parent;
+  nodes_[new_parent].aabb = AABB::Union(leaf_aabb, nodes_[sibling].aabb);
+  nodes_[new_parent].height = nodes_[sibling].height + 1;
+  nodes_[new_parent].left = sibling;
+  nodes_[new_parent].right = leaf;
+  nodes_[sibling].parent = new_parent;
+  nodes_[leaf].parent = new_parent;
+  if (old_parent == kNullNode) {
+    root_ = new_parent;
+  } else if (nodes_[old_parent].left == sibling) {
+    nodes_[old_parent].left = new_parent;
+  } else {
+    nodes_[old_parent].right = new_parent;
+  }
+  Refit(nodes_[leaf].parent);
+}
+
+void AABBTree::RemoveLeaf(int leaf) {
+  if (leaf == root_) {
+    root_ = kNullNode;
+    return;
+  }
+  auto parent = nodes_[leaf].parent;
+  auto grand_parent = nodes_[parent].parent;
+  auto sibling = nodes_[parent].left == leaf ? nodes_[parent].right : nodes_[parent].left;
+  if (grand_parent == kNullNode) {
+    root_ = sibling;
+    nodes_[sibling].parent = kNullNode;
+    FreeNode(parent);
+    return;
+  }
+  if (nodes_[grand_parent].left == parent) {
+    nodes_[grand_parent].left = sibling;
+  } else {
+    nodes_[grand_parent].right = sibling;
+  }
+  nodes_[sibling].parent = grand_parent;
+  FreeNode(parent);
+  Refit(grand_parent);
+}
+
+// Walk back to the root, fixing heights and boxes and rebalancing
+void AABBTree::Refit(int node) {
+  while (node != kNullNode) {
+    node = Balance(node);
+    auto left = nodes_[node].left;
+    auto right = nodes_[node].right;
+    nodes_[node].height = 1 + std::max(nodes_[left].height, nodes_[right].height);
+    nodes_[node].aabb = AABB::Union(nodes_[left].aabb, nodes_[right].aabb);
+    node = nodes_[node].parent;
+  }
+}
+
+// Rotate the higher grand child up if the subtree is out of balance.
+// Return the index of the node now at the root of this subtree.
+int AABBTree::Balance(int a) {
+  if (nodes_[a].IsLeaf() || nodes_[a].height < 2) {
+    return a;
+  }
+  auto b = nodes_[a].left;
+  auto c = nodes_[a].right;
+  auto balance = nodes_[c].height - nodes_[b].height;
+  if (abs(balance) <= 1) {
+    return a;
+  }
+
+  // Rotate the higher child 'up' to replace 'a'
+  auto up = balance > 0 ? c : b;
+  auto down = balance > 0 ? b : c;
+  auto f = nodes_[up].left;
+  auto g = nodes_[up].right;
+
+  nodes_[up].left = a;
+  nodes_[up].parent = nodes_[a].parent;
+  nodes_[a].parent = up;
+  if (nodes_[up].parent == kNullNode) {
+    root_ = up;
+  } else if (nodes_[nodes_[up].parent].left == a) {
+    nodes_[nodes_[up].parent].left = up;
+  } else {
+    nodes_[nodes_[up].parent].right = up;
+  }
+
+  // The higher grand child stays with 'up', the other one goes to 'a'
+  auto keep = nodes_[f].height > nodes_[g].height ? f : g;
+  auto move = keep == f ? g : f;
+  nodes_[up].right = keep;
+  if (balance > 0) {
+    nodes_[a].right = move;
+  } else {
+    nodes_[a].left = move;
+  }
+  nodes_[move].parent = a;
+
+  nodes_[a].aabb = AABB::Union(nodes_[down].aabb, nodes_[move].aabb);
+  nodes_[a].height = 1 + std::max(nodes_[down].height, nodes_[move].height);
+  nodes_[up].aabb = AABB::Union(nodes_[a].aabb, nodes_[keep].aabb);
+  nodes_[up].height = 1 + std::max(nodes_[a].height, nodes_[keep].height);
+  return up;
+}
+
+void SweepAndPrune::Add(const AABB& aabb, bool is_static, void* user_data) {
+  Proxy proxy {aabb.lower.x, aabb.upper.x, aabb.lower.y, aabb.upper.y,
+               user_data, is_static};
+  max_width_ = std::max(max_width_, aabb.upper.x - aabb.lower.x);
+  // Keep sorted, bodies are usually added in bulk before the first step
+  auto pos = std::upper_bound(proxies_.begin(), proxies_.end(), proxy,
+      [](const Proxy& a, const Proxy& b) { return a.lower_x < b.lower_x; });
+  proxies_.insert(pos, proxy);
+}
+
+void SweepAndPrune::Append(const AABB& aabb, bool is_static, void* user_data) {
+  proxies_.push_back({aabb.lower.x, aabb.upper.x, aabb.lower.y, aabb.upper.y,
+                      user_data, is_static});
+  max_width_ = std::max(max_width_, aabb.upper.x - aabb.lower.x);
+}
+
+// Equal boxes keep the order of insertion like Add()
+void SweepAndPrune::Merge(size_t first) {
+  auto less = [](const Proxy& a, const Proxy& b) { return a.lower_x < b.lower_x; };
+  auto mid = proxies_.begin() + first;
+  std::stable_sort(mid, proxies_.end(), less);
+  std::inplace_merge(proxies_.begin(), mid, proxies_.end(), less);
+}
+
+void SweepAndPrune::Clear() {
+  proxies_.clear();
+  pairs_.clear();
+  max_width_ = 0;
+}
+
+void SweepAndPrune::Sort() {
+  max_width_ = 0;
+  for (size_t i = 0; i < proxies_.size(); ++i) {
+    auto proxy = proxies_[i];
+    max_width_ = std::max(max_width_, proxy.upper_x - proxy.lower_x);
+    auto j = i;
+    for (; j > 0 && proxies_[j-1].lower_x > proxy.lower_x; --j) {
+      proxies_[j] = proxies_[j-1];
+    }
+    proxies_[j] = proxy;
+  }
+}
+
+void SweepAndPrune::ReservePairs(size_t count, size_t pairs_per_box) {
+  auto num_chunks = (count + kChunkSize - 1) / kChunkSize;
+  if (chunk_pairs_.size() < num_chunks) {
+    chunk_pairs_.resize(num_chunks);
+  }
+  for (auto& pairs : chunk_pairs_) {
+    pairs.reserve((count < kChunkSize ? count : kChunkSize) * pairs_per_box);
+  }
+  pairs_.reserve(count * pairs_per_box);
+}
+
+void SweepAndPrune::FindPairs(ThreadPool& pool) {
+  auto n = proxies_.size();
+  auto num_chunks = (n + kChunkSize - 1) / kChunkSize;
+  if (chunk_pairs_.size() < num_chunks) {
+    chunk_pairs_.resize(num_chunks);
+  }
+  pool.ParallelFor(n, kChunkSize, [&](size_t begin, size_t end) {
+    auto& pairs = chunk_pairs_[begin / kChunkSize];
+    pairs.clear();
+    for (size_t i = begin; i < end; ++i) {
+      auto& a = proxies_[i];
+      for (size_t j = i + 1; j < n && proxies_[j].lower_x <= a.upper_x; ++j) {
+        auto& b = proxies_[j];
+        if (a.is_static && b.is_static) {
+          continue;
+        }
+        if (b.lower_y > a.upper_y || b.upper_y < a.lower_y) {
+          continue;
+        }
+        pairs.emplace_back(a.user_data, b.user_data);
+      }
+    }
+  });
+  pairs_.clear();
+  for (size_t i = 0; i < num_chunks; ++i) {
+    pairs_.insert(pairs_.end(), chunk_pairs_[i].begin(), chunk_pairs_[i].end());
+  }
+}
+
+}
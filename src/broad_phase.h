@@ -0,0 +1,316 @@
+#pragma once
+
+#include "apollonia.h"
+#include "base/allocator.h"
+#include "base/math.h"
+#include "base/thread_pool.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+
+namespace apollonia {
+
+class World;
+
+struct AABB {
+  Vec2 lower;
+  Vec2 upper;
+
+  AABB() {}
+  AABB(const Vec2& lower, const Vec2& upper) : lower(lower), upper(upper) {}
+
+  bool Overlaps(const AABB& other) const {
+    return !(other.lower.x > upper.x || other.upper.x < lower.x ||
+             other.lower.y > upper.y || other.upper.y < lower.y);
+  }
+  bool Contains(const AABB& other) const {
+    return lower.x <= other.lower.x && lower.y <= other.lower.y &&
+           other.upper.x <= upper.x && other.upper.y <= upper.y;
+  }
+  // Whether the segment p1 + d * t, 0 <= t <= max_fraction, crosses the
+  // box, by clipping it with the slabs of both axes
+  bool Intersects(const Vec2& p1, const Vec2& d, Float max_fraction) const {
+    Float t_min = 0, t_max = max_fraction;
+    auto Clip = [&](Float p, Float d, Float lower, Float upper) {
+      if (d == 0) {
+        return lower <= p && p <= upper;
+      }
+      auto t1 = (lower - p) / d;
+      auto t2 = (upper - p) / d;
+      t_min = std::max(t_min, std::min(t1, t2));
+      t_max = std::min(t_max, std::max(t1, t2));
+      return t_min <= t_max;
+    };
+    return Clip(p1.x, d.x, lower.x, upper.x) && Clip(p1.y, d.y, lower.y, upper.y);
+  }
+  // Half of the perimeter, the 2D surface area heuristic
+  Float Perimeter() const {
+    return (upper.x - lower.x) + (upper.y - lower.y);
+  }
+  AABB Expanded(Float margin) const {
+    return {lower - Vec2(margin, margin), upper + Vec2(margin, margin)};
+  }
+  static AABB Union(const AABB& a, const AABB& b) {
+    return {{std::min(a.lower.x, b.lower.x), std::min(a.lower.y, b.lower.y)},
+            {std::max(a.upper.x, b.upper.x), std::max(a.upper.y, b.upper.y)}};
+  }
+};
+
+// Dynamic bounding volume tree. Leaves hold fattened AABBs so that a proxy
+// only needs to be reinserted when its tight box leaves the fat one.
+class AABBTree {
+ public:
+  // Checkpoints keep the nodes as they are
+  friend class World;
+  static const int kNullNode = -1;
+  // Traversal stack depth, the tree is kept balanced so it never gets near
+  static const int kMaxStackSize = 256;
+  // Fattening applied to every leaf box
+  static constexpr Float kMargin = 0.1;
+
+  AABBTree() {}
+  DISABLE_COPY_AND_ASSIGN(AABBTree)
+
+  int CreateProxy(const AABB& aabb, void* user_data);
+  void DestroyProxy(int proxy);
+  // Room for 'count' proxies in total
+  void Reserve(size_t count) { nodes_.reserve(2 * count); }
+  // Take the proxies and the exact shape of 'other'
+  void CopyFrom(const AABBTree& other);
+  // Reinsert the proxy if 'aabb' escaped its fat box, 'displacement'
+  // predicts the motion and stretches the new fat box along it.
+  // Return true if the proxy was reinserted.
+  bool MoveProxy(int proxy, const AABB& aabb, const Vec2& displacement);
+  void Clear();
+
+  const AABB& FatAABB(int proxy) const { return nodes_[proxy].aabb; }
+  void* UserData(int proxy) const { return nodes_[proxy].user_data; }
+  int Height() const { return root_ == kNullNode ? 0 : nodes_[root_].height; }
+
+  // Call 'callback(proxy)' for each leaf whose fat box overlaps 'aabb'.
+  // Traversal stops if the callback returns false.
+  template <typename Callback>
+  void Query(const AABB& aabb, Callback&& callback) const;
+  // Call 'callback(proxy, max_fraction)' for each leaf whose fat box is
+  // crossed by the segment from 'p1' to 'p2' up to 'max_fraction'. The
+  // callback returns the new max fraction, the traversal stops at 0.
+  template <typename Callback>
+  void RayCast(const Vec2& p1, const Vec2& p2, Float max_fraction,
+               Callback&& callback) const;
+
+ private:
+  struct Node {
+    AABB aabb;
+    void* user_data {nullptr};
+    // Parent for nodes in the tree, next free node for those in free list
+    int parent {kNullNode};
+    int left {kNullNode};
+    int right {kNullNode};
+    // Leaf = 0, free node = -1
+    int height {-1};
+
+    bool IsLeaf() const { return left == kNullNode; }
+  };
+
+  int AllocateNode();
+  void FreeNode(int node);
+  void InsertLeaf(int leaf);
+  void RemoveLeaf(int leaf);
+  int Balance(int node);
+  void Refit(int node);
+
+  Vector<Node> nodes_;
+  int root_ {kNullNode};
+  int free_list_ {kNullNode};
+};
+
+template <typename Callback>
+void AABBTree::Query(const AABB& aabb, Callback&& callback) const {
+  if (root_ == kNullNode) {
+    return;
+  }
+  int stack[kMaxStackSize];
+  int top = 0;
+  stack[top++] = root_;
+  while (top > 0) {
+    auto idx = stack[--top];
+    auto& node = nodes_[idx];
+    if (!node.aabb.Overlaps(aabb)) {
+      continue;
+    }
+    if (node.IsLeaf()) {
+      if (!callback(idx)) {
+        return;
+      }
+    } else {
+      assert(top + 2 <= kMaxStackSize);
+      stack[top++] = node.left;
+      stack[top++] = node.right;
+    }
+  }
+}
+
+template <typename Callback>
+void AABBTree::RayCast(const Vec2& p1, const Vec2& p2, Float max_fraction,
+                       Callback&& callback) const {
+  if (root_ == kNullNode) {
+    return;
+  }
+  auto d = p2 - p1;
+  int stack[kMaxStackSize];
+  int top = 0;
+  stack[top++] = root_;
+  while (top > 0) {
+    auto idx = stack[--top];
+    auto& node = nodes_[idx];
+    if (!node.aabb.Intersects(p1, d, max_fraction)) {
+      continue;
+    }
+    if (node.IsLeaf()) {
+      max_fraction = callback(idx, max_fraction);
+      if (max_fraction == 0) {
+        return;
+      }
+    } else {
+      assert(top + 2 <= kMaxStackSize);
+      stack[top++] = node.left;
+      stack[top++] = node.right;
+    }
+  }
+}
+
+// Incremental sort and sweep. Boxes live in a flat array sorted by their
+// lower x bound, a step mostly moves few entries so insertion sort is
+// close to linear. The sweep is split into chunks run in parallel.
+class SweepAndPrune {
+ public:
+  // Checkpoints keep the boxes in their order
+  friend class World;
+  using PairList = Vector<std::pair<void*, void*>>;
+
+  SweepAndPrune() {}
+  DISABLE_COPY_AND_ASSIGN(SweepAndPrune)
+
+  void Add(const AABB& aabb, bool is_static, void* user_data);
+  // Add without keeping the order, for adding many boxes at once.
+  // Merge(first) puts the boxes appended from 'first' on in order.
+  void Append(const AABB& aabb, bool is_static, void* user_data);
+  void Merge(size_t first);
+  void Reserve(size_t count) { proxies_.reserve(count); }
+  // Room for 'pairs_per_box' pairs per box of 'count' boxes
+  void ReservePairs(size_t count, size_t pairs_per_box);
+  // Take the boxes of 'other' in its order
+  void CopyFrom(const SweepAndPrune& other) {
+    proxies_ = other.proxies_;
+    max_width_ = other.max_width_;
+  }
+  void Clear();
+  size_t size() const { return proxies_.size(); }
+
+  // Refresh the boxes by 'bound(user_data)' and restore the order
+  template <typename Bound>
+  void Update(ThreadPool& pool, Bound&& bound);
+  // Collect the overlapping pairs, at least one of them is not static
+  void FindPairs(ThreadPool& pool);
+  const PairList& pairs() const { return pairs_; }
+
+  // Call 'callback(user_data)' for each box overlapping 'aabb' as of the
+  // last Update(). Stops if the callback returns false.
+  template <typename Callback>
+  void Query(const AABB& aabb, Callback&& callback) const;
+  // Call 'callback(user_data, max_fraction)' for each box crossed by the
+  // segment from 'p1' to 'p2' up to 'max_fraction', like AABBTree::RayCast
+  template <typename Callback>
+  void RayCast(const Vec2& p1, const Vec2& p2, Float max_fraction,
+               Callback&& callback) const;
+
+ private:
+  struct Proxy {
+    Float lower_x;
+    Float upper_x;
+    Float lower_y;
+    Float upper_y;
+    void* user_data;
+    bool is_static;
+  };
+  // Entries swept by one task, results are merged in chunk order
+  static const size_t kChunkSize = 256;
+
+  // Sort the boxes and find the widest
+  void Sort();
+  // First box that may reach 'lower_x', no box starting before it is
+  // wider than max_width_
+  const Proxy* LowerBound(Float lower_x) const;
+
+  Vector<Proxy> proxies_;
+  Float max_width_ {0};
+  Vector<PairList> chunk_pairs_;
+  PairList pairs_;
+};
+
+template <typename Bound>
+void SweepAndPrune::Update(ThreadPool& pool, Bound&& bound) {
+  pool.ParallelFor(proxies_.size(), kChunkSize, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      auto& proxy = proxies_[i];
+      AABB aabb = bound(proxy.user_data);
+      proxy.lower_x = aabb.lower.x;
+      proxy.upper_x = aabb.upper.x;
+      proxy.lower_y = aabb.lower.y;
+      proxy.upper_y = aabb.upper.y;
+    }
+  });
+  Sort();
+}
+
+inline const SweepAndPrune::Proxy* SweepAndPrune::LowerBound(Float lower_x) const {
+  return std::lower_bound(proxies_.data(), proxies_.data() + proxies_.size(),
+                          lower_x - max_width_, [](const Proxy& proxy, Float x) {
+                            return proxy.lower_x < x;
+                          });
+}
+
+// The boxes overlapping 'aabb' on x start between its lower bound less the
+// widest box and its upper bound
+template <typename Callback>
+void SweepAndPrune::Query(const AABB& aabb, Callback&& callback) const {
+  auto end = proxies_.data() + proxies_.size();
+  for (auto proxy = LowerBound(aabb.lower.x); proxy != end; ++proxy) {
+    if (proxy->lower_x > aabb.upper.x) {
+      return;
+    }
+    if (proxy->upper_x < aabb.lower.x ||
+        proxy->lower_y > aabb.upper.y || proxy->upper_y < aabb.lower.y) {
+      continue;
+    }
+    if (!callback(proxy->user_data)) {
+      return;
+    }
+  }
+}
+
+// Scan the boxes of the span of the segment on x
+template <typename Callback>
+void SweepAndPrune::RayCast(const Vec2& p1, const Vec2& p2, Float max_fraction,
+                            Callback&& callback) const {
+  auto d = p2 - p1;
+  auto end = proxies_.data() + proxies_.size();
+  auto x1 = p1.x + d.x * max_fraction;
+  for (auto proxy = LowerBound(std::min(p1.x, x1)); proxy != end; ++proxy) {
+    // A hit shortens the segment
+    if (proxy->lower_x > std::max(p1.x, p1.x + d.x * max_fraction)) {
+      return;
+    }
+    AABB aabb({proxy->lower_x, proxy->lower_y}, {proxy->upper_x, proxy->upper_y});
+    if (!aabb.Intersects(p1, d, max_fraction)) {
+      continue;
+    }
+    max_fraction = callback(proxy->user_data, max_fraction);
+    if (max_fraction == 0) {
+      return;
+    }
+  }
+}
+
+}
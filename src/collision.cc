@@ -8,11 +8,10 @@ namespace apollonia {
 using std::abs;
 
 static size_t FindIncidentEdge(const Vec2& normal, const PolygonBody& body) {
-  size_t idx;
+  size_t idx = 0;
   auto min_dot = kInf;
   for (size_t i = 0; i < body.Count(); ++i) {
-    auto edge_normal = body.EdgeAt(i).Normal();
-    auto dot = Dot(edge_normal, normal);
+    auto dot = Dot(body.WorldNormal(i), normal);
     if (dot < min_dot) {
       min_dot = dot;
       idx = i;
@@ -48,14 +47,16 @@ static size_t Clip(Arbiter::ContactList& contacts_out,
   return num_out;
 }
 
-Arbiter* Collide(PolygonBody* pa, PolygonBody* pb) {
+static bool CollidePolygons(Arbiter& arbiter, Body& body_a, Body& body_b) {
+  auto pa = static_cast<PolygonBody*>(&body_a);
+  auto pb = static_cast<PolygonBody*>(&body_b);
   size_t ia, ib;
   Float sa, sb;
   if ((sa = pa->FindMinSeparatingAxis(ia, *pb)) >= 0) {
-    return nullptr;
+    return false;
   }
   if ((sb = pb->FindMinSeparatingAxis(ib, *pa)) >= 0) {
-    return nullptr;
+    return false;
   }
   if (sa < sb) {
     std::swap(sa, sb);
@@ -64,7 +65,7 @@ Arbiter* Collide(PolygonBody* pa, PolygonBody* pb) {
   }
   auto& a = *pa;
   auto& b = *pb;
-  auto normal = a.EdgeAt(ia).Normal();
+  auto normal = a.WorldNormal(ia);
   auto idx = FindIncidentEdge(normal, b);
   auto next_idx = (idx + 1) % b.Count();
   Arbiter::ContactList contacts = {{b, idx}, {b, next_idx}};
@@ -73,34 +74,131 @@ Arbiter* Collide(PolygonBody* pa, PolygonBody* pb) {
     if (i == ia) {
       continue;
     }
-    auto v0 = a.LocalToWorld(a[i]);
-    auto v1 = a.LocalToWorld(a[(i+1)%a.Count()]);
+    auto& v0 = a.WorldVertex(i);
+    auto& v1 = a.WorldVertex((i+1)%a.Count());
     auto num = Clip(clipped_contacts, contacts, i, v0, v1);
     if (num < 2) {
-      return nullptr;
+      return false;
     }
     assert(num == 2);
     contacts = clipped_contacts;
   }
 
-  auto va = a.LocalToWorld(a[ia]);
-  auto arbiter = World::NewArbiter(a, b, normal);
+  auto& va = a.WorldVertex(ia);
+  arbiter.Reset(a, b, normal);
   for (auto& contact : clipped_contacts) {
     auto sep = Dot(contact.position - va, normal);
     if (sep <= 0) {
       contact.separation = sep;
       contact.ra = contact.position - a.LocalToWorld(a.centroid());
       contact.rb = contact.position - b.LocalToWorld(b.centroid());
-      arbiter->AddContact(contact);
+      arbiter.AddContact(contact);
+    }
+  }
+  return true;
+}
+
+static bool CollideCircles(Arbiter& arbiter, Body& body_a, Body& body_b) {
+  auto& a = static_cast<CircleBody&>(body_a);
+  auto& b = static_cast<CircleBody&>(body_b);
+  auto d = b.center() - a.center();
+  auto radius = a.radius() + b.radius();
+  auto dist_sq = Dot(d, d);
+  if (dist_sq >= radius * radius) {
+    return false;
+  }
+  auto dist = sqrt(dist_sq);
+  // Concentric circles are pushed apart along an arbitrary axis
+  auto normal = dist > 0 ? d / dist : Vec2(0, 1);
+  Contact contact;
+  contact.indices = {{0, 0}};
+  std::fill(contact.from_a.begin(), contact.from_a.end(), false);
+  // The deepest point of 'b' in 'a'
+  contact.position = b.center() - normal * b.radius();
+  contact.separation = dist - radius;
+  contact.ra = contact.position - a.center();
+  contact.rb = contact.position - b.center();
+  arbiter.Reset(a, b, normal);
+  arbiter.AddContact(contact);
+  return true;
+}
+
+// The normal points from the circle to the polygon
+static bool CollideCirclePolygon(Arbiter& arbiter, Body& body_a, Body& body_b) {
+  auto& a = static_cast<CircleBody&>(body_a);
+  auto& b = static_cast<PolygonBody&>(body_b);
+  auto& center = a.center();
+  auto radius = a.radius();
+  // Edge of the polygon with max separation from the center
+  size_t idx = 0;
+  auto separation = -kInf;
+  for (size_t i = 0; i < b.Count(); ++i) {
+    auto sep = Dot(center - b.WorldVertex(i), b.WorldNormal(i));
+    if (sep > radius) {
+      return false;
+    }
+    if (sep > separation) {
+      separation = sep;
+      idx = i;
+    }
+  }
+
+  // Outward normal of the polygon at the closest feature
+  Vec2 normal;
+  size_t feature = idx;
+  bool at_vertex = false;
+  if (separation <= 0) {
+    // The center is inside the polygon
+    normal = b.WorldNormal(idx);
+  } else {
+    auto& v0 = b.WorldVertex(idx);
+    auto& v1 = b.WorldVertex((idx+1)%b.Count());
+    auto edge = v1 - v0;
+    auto t = Dot(center - v0, edge) / Dot(edge, edge);
+    if (t <= 0 || t >= 1) {
+      // Closest to a vertex
+      feature = t <= 0 ? idx : (idx+1)%b.Count();
+      at_vertex = true;
+      auto d = center - b.WorldVertex(feature);
+      auto dist_sq = Dot(d, d);
+      if (dist_sq > radius * radius) {
+        return false;
+      }
+      separation = sqrt(dist_sq);
+      normal = d / separation;
+    } else {
+      normal = b.WorldNormal(idx);
     }
   }
-  return arbiter;
+
+  Contact contact;
+  contact.indices = {{feature, feature}};
+  // A vertex and an edge of the same index are different features
+  contact.from_a = {{at_vertex, false}};
+  contact.position = center - normal * radius;
+  contact.separation = separation - radius;
+  contact.ra = contact.position - center;
+  contact.rb = contact.position - b.LocalToWorld(b.centroid());
+  arbiter.Reset(a, b, -normal);
+  arbiter.AddContact(contact);
+  return true;
 }
 
+static bool CollidePolygonCircle(Arbiter& arbiter, Body& a, Body& b) {
+  return CollideCirclePolygon(arbiter, b, a);
+}
+
+const CollideFunc kCollideTable[kNumShapeTypes][kNumShapeTypes] = {
+  // kPolygon
+  {CollidePolygons, CollidePolygonCircle},
+  // kCircle
+  {CollideCirclePolygon, CollideCircles},
+};
+
 Contact::Contact(const PolygonBody& b, size_t idx) {
   indices = {{idx, idx}};
   std::fill(from_a.begin(), from_a.end(), false);
-  position = b.LocalToWorld(b[idx]);
+  position = b.WorldVertex(idx);
 }
 
 
@@ -116,20 +214,36 @@ bool Arbiter::operator==(const Arbiter& other) const {
   return true;
 }
 
-void Arbiter::PreStep(Float dt) {
+void Arbiter::Reset(const Body& a, const Body& b, const Vec2& normal) {
+  a_ = a.id();
+  b_ = b.id();
+  normal_ = normal;
+  contacts_.clear();
+}
+
+void Arbiter::PreStep(BodyStorage& bodies, Float dt) {
   static const Float kAllowedPenetration = 0.01;
   static const Float kBiasFactor = 0.2;
-  auto tangent = normal_.Normal();
+  auto tangent = tangent_ = normal_.Normal();
+  friction_ = sqrt(bodies.friction[a_] * bodies.friction[b_]);
+  auto inv_mass = bodies.inv_mass[a_] + bodies.inv_mass[b_];
+  auto inv_inertia_a = bodies.inv_inertia[a_];
+  auto inv_inertia_b = bodies.inv_inertia[b_];
   for (auto& contact : contacts_) {
-    auto kn = a_.inv_mass() + b_.inv_mass() +
-              Dot(a_.inv_inertia() * Cross(Cross(contact.ra, normal_), contact.ra) +
-                  b_.inv_inertia() * Cross(Cross(contact.rb, normal_), contact.rb), normal_);
-    auto kt = a_.inv_mass() + b_.inv_mass() +
-              Dot(a_.inv_inertia() * Cross(Cross(contact.ra, tangent), contact.ra) +
-                  b_.inv_inertia() * Cross(Cross(contact.rb, tangent), contact.rb), tangent);
+    auto kn = inv_mass +
+              Dot(inv_inertia_a * Cross(Cross(contact.ra, normal_), contact.ra) +
+                  inv_inertia_b * Cross(Cross(contact.rb, normal_), contact.rb), normal_);
+    auto kt = inv_mass +
+              Dot(inv_inertia_a * Cross(Cross(contact.ra, tangent), contact.ra) +
+                  inv_inertia_b * Cross(Cross(contact.rb, tangent), contact.rb), tangent);
     contact.mass_normal = 1 / kn;
     contact.mass_tangent = 1 / kt;
     contact.bias = -kBiasFactor / dt * std::min(0.0f, contact.separation + kAllowedPenetration);
+
+    // Warm starting
+    auto p = contact.pn * normal_ + contact.pt * tangent;
+    bodies.ApplyImpulse(a_, -p, contact.ra);
+    bodies.ApplyImpulse(b_, p, contact.rb);
     /*
     glPointSize(4.0f);
     glColor3f(1.0f, 0.0f, 0.0f);
@@ -141,60 +255,32 @@ void Arbiter::PreStep(Float dt) {
   }
 }
 
-void Arbiter::ApplyImpulse() {
-  auto tangent = normal_.Normal();
-  for (auto& contact : contacts_) {
-    Vec2 dv = (b_.velocity() + Cross(b_.angular_velocity(), contact.rb)) -
-              (a_.velocity() + Cross(a_.angular_velocity(), contact.ra));
-
-    auto vn = Dot(dv, normal_);
-    auto dpn = (-vn + contact.bias) * contact.mass_normal;
-    dpn = std::max(contact.pn + dpn, 0.0f) - contact.pn;
-
-    Float friction = sqrt(a_.friction() * b_.friction());
-    auto vt = Dot(dv, tangent);
-    auto dpt = -vt * contact.mass_tangent;
-    dpt = std::max(-friction * contact.pn, std::min(friction * contact.pn, contact.pt + dpt)) - contact.pt;
-
-    auto p = dpn * normal_ + dpt * tangent;
-    a_.ApplyImpulse(-p, contact.ra);
-    b_.ApplyImpulse(p, contact.rb);
-    contact.pn += dpn;
-    contact.pt += dpt;
+void Arbiter::Update(const Arbiter& arbiter) {
+  // Find the accumulated impulses before the old contacts are overwritten
+  std::array<Float, kMaxContacts> pn, pt;
+  std::array<bool, kMaxContacts> matched;
+  for (size_t i = 0; i < arbiter.contacts_.size(); ++i) {
+    auto old_contact = std::find(contacts_.begin(), contacts_.end(), arbiter.contacts_[i]);
+    matched[i] = old_contact != contacts_.end();
+    if (matched[i]) {
+      pn[i] = old_contact->pn;
+      pt[i] = old_contact->pt;
+    }
   }
-}
 
-void Arbiter::AccumulateImpulse(const Arbiter& old_arbiter) {
-  const auto& old_contacts = old_arbiter.contacts_;
-  for (auto& new_contact : contacts_) {
-    auto old_contact = std::find(old_contacts.begin(), old_contacts.end(), new_contact);
-    if (old_contact != old_contacts.end()) {
-      new_contact.pn = old_contact->pn;
-      new_contact.pt = old_contact->pt;
-
-      auto tangent = normal_.Normal();
-      auto p = new_contact.pn * normal_ + new_contact.pt * tangent;
-      a_.ApplyImpulse(-p, new_contact.ra);
-      b_.ApplyImpulse(p, new_contact.rb);
+  a_ = arbiter.a_;
+  b_ = arbiter.b_;
+  normal_ = arbiter.normal_;
+  contacts_ = arbiter.contacts_;
+  for (size_t i = 0; i < contacts_.size(); ++i) {
+    if (matched[i]) {
+      contacts_[i].pn = pn[i];
+      contacts_[i].pt = pt[i];
     }
   }
 }
 
-bool ArbiterKey::operator<(const ArbiterKey& other) const {
-  auto a1 = &this->a_;
-  auto b1 = &this->b_;
-  auto a2 = &other.a_;
-  auto b2 = &other.b_;
-  if (a1 > b1) {
-    std::swap(a1, b1);
-  }
-  if (a2 > b2) {
-    std::swap(a2, b2);
-  }
-  if (a1 != a2) {
-    return a1 < a2;
-  }
-  return b1 < b2;
-}
+ArbiterKey::ArbiterKey(const Body& a, const Body& b)
+    : ArbiterKey(a.id(), b.id()) {}
 
 }
@@ -1,11 +1,16 @@
 #pragma once
 
+#include "base/inline_vector.h"
 #include "base/math.h"
+#include "body.h"
+#include "body_storage.h"
+#include <cstdint>
 #include <vector>
 
 namespace apollonia {
 
 class Body;
+class CircleBody;
 class PolygonBody;
 class World;
 class ArbiterKey;
@@ -22,6 +27,7 @@ struct Contact {
   Float mass_normal;
   Float mass_tangent;
 
+  Contact() {}
   Contact(const PolygonBody& b, size_t idx);
 
   bool operator==(const Contact& other) const {
@@ -41,44 +47,77 @@ class Arbiter {
  public:
   friend class World;
   friend class ArbiterKey;
+  friend struct ContactBatch;
   static const size_t kMaxContacts = 2;
-  using ContactList = std::vector<Contact>;
+  using ContactList = InlineVector<Contact, kMaxContacts>;
 
   bool operator==(const Arbiter& other) const;
-  void PreStep(Float dt);
-  void ApplyImpulse();
-  void AccumulateImpulse(const Arbiter& old_arbiter);
+  // Compute the masses of the contacts and apply the accumulated impulses
+  void PreStep(BodyStorage& bodies, Float dt);
+  // Take the bodies, normal and contacts of 'arbiter', the contacts
+  // matching old ones inherit the accumulated impulses for warm starting.
+  void Update(const Arbiter& arbiter);
+  // Drop the contacts and start over with a new pair
+  void Reset(const Body& a, const Body& b, const Vec2& normal);
   void AddContact(const Contact& contact) {
     contacts_.push_back(contact);
-    assert(contacts_.size() <= kMaxContacts);
   }
 
  private:
-  Arbiter(Body& a, Body& b, const Vec2& normal, const ContactList& contacts)
+  Arbiter() {}
+  Arbiter(BodyId a, BodyId b, const Vec2& normal, const ContactList& contacts)
       : a_(a), b_(b), normal_(normal), contacts_(contacts) {}
-  Body& a_;
-  Body& b_;
+  BodyId a_ {0};
+  BodyId b_ {0};
   Vec2 normal_;
+  // Cached by PreStep for the iterations
+  Vec2 tangent_;
+  Float friction_ {0};
   ContactList contacts_;
 };
 
+// Identify an unordered pair of bodies by their ids
 class ArbiterKey {
  public:
-  ArbiterKey(const Body& a, const Body& b) : a_(a), b_(b) {}
+  ArbiterKey(BodyId a, BodyId b)
+      : value_(a < b ? uint64_t(a) << 32 | b : uint64_t(b) << 32 | a) {}
+  ArbiterKey(const Body& a, const Body& b);
   ArbiterKey(const Arbiter& arbiter) : ArbiterKey(arbiter.a_, arbiter.b_) {}
-  bool operator<(const ArbiterKey& other) const;
+  explicit ArbiterKey(uint64_t value) : value_(value) {}
+  uint64_t value() const { return value_; }
+  size_t Hash() const {
+    // Finalizer of MurmurHash3
+    auto h = value_;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+  }
   bool operator==(const ArbiterKey& other) const {
-    return !(*this < other) && !(other < *this);
+    return value_ == other.value_;
   }
   bool operator!=(const ArbiterKey& other) const {
     return !(*this == other);
   }
 
  private:
-  const Body& a_;
-  const Body& b_;
+  uint64_t value_;
 };
 
-Arbiter* Collide(PolygonBody* pa, PolygonBody* pb);
+// Fill 'arbiter' with the contacts of two bodies, the normal points
+// from the first body of the arbiter to the second one.
+// Return false if they do not collide.
+using CollideFunc = bool (*)(Arbiter& arbiter, Body& a, Body& b);
+
+// Narrow phase routines indexed by the shape types of the pair
+extern const CollideFunc kCollideTable[kNumShapeTypes][kNumShapeTypes];
+
+inline bool Collide(Arbiter& arbiter, Body& a, Body& b) {
+  auto ta = static_cast<size_t>(a.shape_type());
+  auto tb = static_cast<size_t>(b.shape_type());
+  return kCollideTable[ta][tb](arbiter, a, b);
+}
 
 }
@@ -0,0 +1,378 @@
+#include "contact_solver.h"
+#include <cmath>
+#include <type_traits>
+
+// This file is built without floating point contraction. The kernels
+// run the same operations in the same order on every lane, and max/min
+// pick the same operand as _mm_max_ps/_mm_min_ps, so all levels give
+// bit identical results.
+
+namespace apollonia {
+
+static_assert(std::is_same<Float, float>::value, "The kernels work on float");
+
+void ContactBatch::PreStep(BodyStorage& bodies, Float dt) {
+  for (size_t lane = 0; lane < kLanes; ++lane) {
+    if (lane >= count) {
+      // Idle lanes read the bodies of lane 0 and write nothing
+      a[lane] = a[0];
+      b[lane] = b[0];
+      normal_x[lane] = normal_y[lane] = tangent_x[lane] = tangent_y[lane] = 0;
+      friction[lane] = 0;
+      inv_mass_a[lane] = inv_mass_b[lane] = 0;
+      inv_inertia_a[lane] = inv_inertia_b[lane] = 0;
+      for (auto& point : points) {
+        point.ra_x[lane] = point.ra_y[lane] = point.rb_x[lane] = point.rb_y[lane] = 0;
+        point.mass_normal[lane] = point.mass_tangent[lane] = point.bias[lane] = 0;
+        point.pn[lane] = point.pt[lane] = 0;
+      }
+      continue;
+    }
+
+    auto& arbiter = *this->arbiter[lane];
+    arbiter.PreStep(bodies, dt);
+    a[lane] = arbiter.a_;
+    b[lane] = arbiter.b_;
+    normal_x[lane] = arbiter.normal_.x;
+    normal_y[lane] = arbiter.normal_.y;
+    tangent_x[lane] = arbiter.tangent_.x;
+    tangent_y[lane] = arbiter.tangent_.y;
+    friction[lane] = arbiter.friction_;
+    inv_mass_a[lane] = bodies.inv_mass[a[lane]];
+    inv_mass_b[lane] = bodies.inv_mass[b[lane]];
+    inv_inertia_a[lane] = bodies.inv_inertia[a[lane]];
+    inv_inertia_b[lane] = bodies.inv_inertia[b[lane]];
+    for (size_t i = 0; i < kPoints; ++i) {
+      auto& point = points[i];
+      if (i >= arbiter.contacts_.size()) {
+        // Zero masses make the point apply zero impulses
+        point.ra_x[lane] = point.ra_y[lane] = point.rb_x[lane] = point.rb_y[lane] = 0;
+        point.mass_normal[lane] = point.mass_tangent[lane] = point.bias[lane] = 0;
+        point.pn[lane] = point.pt[lane] = 0;
+        continue;
+      }
+      auto& contact = arbiter.contacts_[i];
+      point.ra_x[lane] = contact.ra.x;
+      point.ra_y[lane] = contact.ra.y;
+      point.rb_x[lane] = contact.rb.x;
+      point.rb_y[lane] = contact.rb.y;
+      point.mass_normal[lane] = contact.mass_normal;
+      point.mass_tangent[lane] = contact.mass_tangent;
+      point.bias[lane] = contact.bias;
+      point.pn[lane] = contact.pn;
+      point.pt[lane] = contact.pt;
+    }
+  }
+}
+
+void ContactBatch::Store() const {
+  for (size_t lane = 0; lane < count; ++lane) {
+    auto& contacts = arbiter[lane]->contacts_;
+    for (size_t i = 0; i < contacts.size(); ++i) {
+      contacts[i].pn = points[i].pn[lane];
+      contacts[i].pt = points[i].pt[lane];
+    }
+  }
+}
+
+static inline Float Max(Float a, Float b) {
+  return a > b ? a : b;
+}
+
+static inline Float Min(Float a, Float b) {
+  return a < b ? a : b;
+}
+
+static Float SolveContactsScalar(BodyStorage& bodies, ContactBatch* batches,
+                                 size_t count) {
+  Float residual = 0;
+  for (size_t i = 0; i < count; ++i) {
+    auto& batch = batches[i];
+    for (size_t lane = 0; lane < batch.count; ++lane) {
+      auto a = batch.a[lane];
+      auto b = batch.b[lane];
+      auto vax = bodies.velocity[a].x;
+      auto vay = bodies.velocity[a].y;
+      auto wa = bodies.angular_velocity[a];
+      auto vbx = bodies.velocity[b].x;
+      auto vby = bodies.velocity[b].y;
+      auto wb = bodies.angular_velocity[b];
+      auto nx = batch.normal_x[lane];
+      auto ny = batch.normal_y[lane];
+      auto tx = batch.tangent_x[lane];
+      auto ty = batch.tangent_y[lane];
+      auto friction = batch.friction[lane];
+      auto ima = batch.inv_mass_a[lane];
+      auto imb = batch.inv_mass_b[lane];
+      auto iia = batch.inv_inertia_a[lane];
+      auto iib = batch.inv_inertia_b[lane];
+      for (auto& point : batch.points) {
+        auto rax = point.ra_x[lane];
+        auto ray = point.ra_y[lane];
+        auto rbx = point.rb_x[lane];
+        auto rby = point.rb_y[lane];
+        auto pn = point.pn[lane];
+        auto pt = point.pt[lane];
+        // Relative velocity at the contact
+        auto dvx = (vbx - wb * rby) - (vax - wa * ray);
+        auto dvy = (vby + wb * rbx) - (vay + wa * rax);
+
+        auto vn = dvx * nx + dvy * ny;
+        auto dpn = (point.bias[lane] - vn) * point.mass_normal[lane];
+        dpn = Max(pn + dpn, 0.0f) - pn;
+
+        auto vt = dvx * tx + dvy * ty;
+        auto dpt = -(vt * point.mass_tangent[lane]);
+        auto max_pt = friction * pn;
+        dpt = Max(-max_pt, Min(max_pt, pt + dpt)) - pt;
+
+        auto px = dpn * nx + dpt * tx;
+        auto py = dpn * ny + dpt * ty;
+        vax = vax - px * ima;
+        vay = vay - py * ima;
+        wa = wa - iia * (rax * py - ray * px);
+        vbx = vbx + px * imb;
+        vby = vby + py * imb;
+        wb = wb + iib * (rbx * py - rby * px);
+        point.pn[lane] = pn + dpn;
+        point.pt[lane] = pt + dpt;
+        residual = Max(residual, Max(std::abs(dpn), std::abs(dpt)));
+      }
+      if (ima != 0) {
+        bodies.velocity[a] = {vax, vay};
+        bodies.angular_velocity[a] = wa;
+      }
+      if (imb != 0) {
+        bodies.velocity[b] = {vbx, vby};
+        bodies.angular_velocity[b] = wb;
+      }
+    }
+  }
+  return residual;
+}
+
+#ifdef APOLLONIA_X86
+
+// Write back the velocities of the used lanes with dynamic bodies
+static inline void Scatter(BodyStorage& bodies, const BodyId* ids,
+                           const Float* inv_mass, size_t lanes, const Float* vx,
+                           const Float* vy, const Float* w) {
+  for (size_t lane = 0; lane < lanes; ++lane) {
+    if (inv_mass[lane] != 0) {
+      bodies.velocity[ids[lane]] = {vx[lane], vy[lane]};
+      bodies.angular_velocity[ids[lane]] = w[lane];
+    }
+  }
+}
+
+// The idle lanes and points leave their impulses unchanged, so the
+// residual reduces over all lanes.
+static inline Float MaxLane(const Float* lanes, size_t count) {
+  Float max = 0;
+  for (size_t lane = 0; lane < count; ++lane) {
+    max = Max(max, lanes[lane]);
+  }
+  return max;
+}
+
+APOLLONIA_TARGET("sse2")
+static inline __m128 Gather4(const Float* base, const BodyId* ids,
+                             size_t stride, size_t offset) {
+  return _mm_setr_ps(base[ids[0] * stride + offset], base[ids[1] * stride + offset],
+                     base[ids[2] * stride + offset], base[ids[3] * stride + offset]);
+}
+
+APOLLONIA_TARGET("sse2")
+static Float SolveContactsSse2(BodyStorage& bodies, ContactBatch* batches,
+                               size_t count) {
+  auto velocity = reinterpret_cast<const Float*>(bodies.velocity.data());
+  auto angular_velocity = bodies.angular_velocity.data();
+  auto zero = _mm_setzero_ps();
+  auto sign = _mm_set1_ps(-0.0f);
+  auto residual = zero;
+  for (size_t i = 0; i < count; ++i) {
+    auto& batch = batches[i];
+    for (size_t h = 0; h < batch.count; h += 4) {
+      auto a = batch.a + h;
+      auto b = batch.b + h;
+      auto vax = Gather4(velocity, a, 2, 0);
+      auto vay = Gather4(velocity, a, 2, 1);
+      auto wa = Gather4(angular_velocity, a, 1, 0);
+      auto vbx = Gather4(velocity, b, 2, 0);
+      auto vby = Gather4(velocity, b, 2, 1);
+      auto wb = Gather4(angular_velocity, b, 1, 0);
+      auto nx = _mm_loadu_ps(batch.normal_x + h);
+      auto ny = _mm_loadu_ps(batch.normal_y + h);
+      auto tx = _mm_loadu_ps(batch.tangent_x + h);
+      auto ty = _mm_loadu_ps(batch.tangent_y + h);
+      auto friction = _mm_loadu_ps(batch.friction + h);
+      auto ima = _mm_loadu_ps(batch.inv_mass_a + h);
+      auto imb = _mm_loadu_ps(batch.inv_mass_b + h);
+      auto iia = _mm_loadu_ps(batch.inv_inertia_a + h);
+      auto iib = _mm_loadu_ps(batch.inv_inertia_b + h);
+      for (auto& point : batch.points) {
+        auto rax = _mm_loadu_ps(point.ra_x + h);
+        auto ray = _mm_loadu_ps(point.ra_y + h);
+        auto rbx = _mm_loadu_ps(point.rb_x + h);
+        auto rby = _mm_loadu_ps(point.rb_y + h);
+        auto pn = _mm_loadu_ps(point.pn + h);
+        auto pt = _mm_loadu_ps(point.pt + h);
+        auto dvx = _mm_sub_ps(_mm_sub_ps(vbx, _mm_mul_ps(wb, rby)),
+                              _mm_sub_ps(vax, _mm_mul_ps(wa, ray)));
+        auto dvy = _mm_sub_ps(_mm_add_ps(vby, _mm_mul_ps(wb, rbx)),
+                              _mm_add_ps(vay, _mm_mul_ps(wa, rax)));
+
+        auto vn = _mm_add_ps(_mm_mul_ps(dvx, nx), _mm_mul_ps(dvy, ny));
+        auto dpn = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(point.bias + h), vn),
+                              _mm_loadu_ps(point.mass_normal + h));
+        dpn = _mm_sub_ps(_mm_max_ps(_mm_add_ps(pn, dpn), zero), pn);
+
+        auto vt = _mm_add_ps(_mm_mul_ps(dvx, tx), _mm_mul_ps(dvy, ty));
+        auto dpt = _mm_xor_ps(_mm_mul_ps(vt, _mm_loadu_ps(point.mass_tangent + h)), sign);
+        auto max_pt = _mm_mul_ps(friction, pn);
+        dpt = _mm_sub_ps(_mm_max_ps(_mm_xor_ps(max_pt, sign),
+                                    _mm_min_ps(max_pt, _mm_add_ps(pt, dpt))), pt);
+
+        auto px = _mm_add_ps(_mm_mul_ps(dpn, nx), _mm_mul_ps(dpt, tx));
+        auto py = _mm_add_ps(_mm_mul_ps(dpn, ny), _mm_mul_ps(dpt, ty));
+        vax = _mm_sub_ps(vax, _mm_mul_ps(px, ima));
+        vay = _mm_sub_ps(vay, _mm_mul_ps(py, ima));
+        wa = _mm_sub_ps(wa, _mm_mul_ps(iia, _mm_sub_ps(_mm_mul_ps(rax, py),
+                                                       _mm_mul_ps(ray, px))));
+        vbx = _mm_add_ps(vbx, _mm_mul_ps(px, imb));
+        vby = _mm_add_ps(vby, _mm_mul_ps(py, imb));
+        wb = _mm_add_ps(wb, _mm_mul_ps(iib, _mm_sub_ps(_mm_mul_ps(rbx, py),
+                                                       _mm_mul_ps(rby, px))));
+        _mm_storeu_ps(point.pn + h, _mm_add_ps(pn, dpn));
+        _mm_storeu_ps(point.pt + h, _mm_add_ps(pt, dpt));
+        residual = _mm_max_ps(residual, _mm_max_ps(_mm_andnot_ps(sign, dpn),
+                                                   _mm_andnot_ps(sign, dpt)));
+      }
+
+      Float x[4], y[4], w[4];
+      auto lanes = std::min<size_t>(4, batch.count - h);
+      _mm_storeu_ps(x, vax);
+      _mm_storeu_ps(y, vay);
+      _mm_storeu_ps(w, wa);
+      Scatter(bodies, a, batch.inv_mass_a + h, lanes, x, y, w);
+      _mm_storeu_ps(x, vbx);
+      _mm_storeu_ps(y, vby);
+      _mm_storeu_ps(w, wb);
+      Scatter(bodies, b, batch.inv_mass_b + h, lanes, x, y, w);
+    }
+  }
+  Float residuals[4];
+  _mm_storeu_ps(residuals, residual);
+  return MaxLane(residuals, 4);
+}
+
+APOLLONIA_TARGET("avx2")
+static inline __m256 Gather8(const Float* base, const BodyId* ids,
+                             int stride, int offset) {
+  auto idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids));
+  idx = _mm256_add_epi32(_mm256_mullo_epi32(idx, _mm256_set1_epi32(stride)),
+                         _mm256_set1_epi32(offset));
+  return _mm256_i32gather_ps(base, idx, sizeof(Float));
+}
+
+APOLLONIA_TARGET("avx2")
+static Float SolveContactsAvx2(BodyStorage& bodies, ContactBatch* batches,
+                               size_t count) {
+  static_assert(ContactBatch::kLanes == 8, "A batch is one ymm register");
+  auto velocity = reinterpret_cast<const Float*>(bodies.velocity.data());
+  auto angular_velocity = bodies.angular_velocity.data();
+  auto zero = _mm256_setzero_ps();
+  auto sign = _mm256_set1_ps(-0.0f);
+  auto residual = zero;
+  for (size_t i = 0; i < count; ++i) {
+    auto& batch = batches[i];
+    auto a = batch.a;
+    auto b = batch.b;
+    auto vax = Gather8(velocity, a, 2, 0);
+    auto vay = Gather8(velocity, a, 2, 1);
+    auto wa = Gather8(angular_velocity, a, 1, 0);
+    auto vbx = Gather8(velocity, b, 2, 0);
+    auto vby = Gather8(velocity, b, 2, 1);
+    auto wb = Gather8(angular_velocity, b, 1, 0);
+    auto nx = _mm256_loadu_ps(batch.normal_x);
+    auto ny = _mm256_loadu_ps(batch.normal_y);
+    auto tx = _mm256_loadu_ps(batch.tangent_x);
+    auto ty = _mm256_loadu_ps(batch.tangent_y);
+    auto friction = _mm256_loadu_ps(batch.friction);
+    auto ima = _mm256_loadu_ps(batch.inv_mass_a);
+    auto imb = _mm256_loadu_ps(batch.inv_mass_b);
+    auto iia = _mm256_loadu_ps(batch.inv_inertia_a);
+    auto iib = _mm256_loadu_ps(batch.inv_inertia_b);
+    for (auto& point : batch.points) {
+      auto rax = _mm256_loadu_ps(point.ra_x);
+      auto ray = _mm256_loadu_ps(point.ra_y);
+      auto rbx = _mm256_loadu_ps(point.rb_x);
+      auto rby = _mm256_loadu_ps(point.rb_y);
+      auto pn = _mm256_loadu_ps(point.pn);
+      auto pt = _mm256_loadu_ps(point.pt);
+      auto dvx = _mm256_sub_ps(_mm256_sub_ps(vbx, _mm256_mul_ps(wb, rby)),
+                               _mm256_sub_ps(vax, _mm256_mul_ps(wa, ray)));
+      auto dvy = _mm256_sub_ps(_mm256_add_ps(vby, _mm256_mul_ps(wb, rbx)),
+                               _mm256_add_ps(vay, _mm256_mul_ps(wa, rax)));
+
+      auto vn = _mm256_add_ps(_mm256_mul_ps(dvx, nx), _mm256_mul_ps(dvy, ny));
+      auto dpn = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(point.bias), vn),
+                               _mm256_loadu_ps(point.mass_normal));
+      dpn = _mm256_sub_ps(_mm256_max_ps(_mm256_add_ps(pn, dpn), zero), pn);
+
+      auto vt = _mm256_add_ps(_mm256_mul_ps(dvx, tx), _mm256_mul_ps(dvy, ty));
+      auto dpt = _mm256_xor_ps(_mm256_mul_ps(vt, _mm256_loadu_ps(point.mass_tangent)), sign);
+      auto max_pt = _mm256_mul_ps(friction, pn);
+      dpt = _mm256_sub_ps(_mm256_max_ps(_mm256_xor_ps(max_pt, sign),
+                                        _mm256_min_ps(max_pt, _mm256_add_ps(pt, dpt))), pt);
+
+      auto px = _mm256_add_ps(_mm256_mul_ps(dpn, nx), _mm256_mul_ps(dpt, tx));
+      auto py = _mm256_add_ps(_mm256_mul_ps(dpn, ny), _mm256_mul_ps(dpt, ty));
+      vax = _mm256_sub_ps(vax, _mm256_mul_ps(px, ima));
+      vay = _mm256_sub_ps(vay, _mm256_mul_ps(py, ima));
+      wa = _mm256_sub_ps(wa, _mm256_mul_ps(iia, _mm256_sub_ps(_mm256_mul_ps(rax, py),
+                                                              _mm256_mul_ps(ray, px))));
+      vbx = _mm256_add_ps(vbx, _mm256_mul_ps(px, imb));
+      vby = _mm256_add_ps(vby, _mm256_mul_ps(py, imb));
+      wb = _mm256_add_ps(wb, _mm256_mul_ps(iib, _mm256_sub_ps(_mm256_mul_ps(rbx, py),
+                                                              _mm256_mul_ps(rby, px))));
+      _mm256_storeu_ps(point.pn, _mm256_add_ps(pn, dpn));
+      _mm256_storeu_ps(point.pt, _mm256_add_ps(pt, dpt));
+      residual = _mm256_max_ps(residual, _mm256_max_ps(_mm256_andnot_ps(sign, dpn),
+                                                       _mm256_andnot_ps(sign, dpt)));
+    }
+
+    Float x[8], y[8], w[8];
+    _mm256_storeu_ps(x, vax);
+    _mm256_storeu_ps(y, vay);
+    _mm256_storeu_ps(w, wa);
+    Scatter(bodies, a, batch.inv_mass_a, batch.count, x, y, w);
+    _mm256_storeu_ps(x, vbx);
+    _mm256_storeu_ps(y, vby);
+    _mm256_storeu_ps(w, wb);
+    Scatter(bodies, b, batch.inv_mass_b, batch.count, x, y, w);
+  }
+  Float residuals[8];
+  _mm256_storeu_ps(residuals, residual);
+  return MaxLane(residuals, 8);
+}
+
+#endif
+
+ContactKernel GetContactKernel(SimdLevel level) {
+  switch (level) {
+  case SimdLevel::kScalar: return SolveContactsScalar;
+#ifdef APOLLONIA_X86
+  case SimdLevel::kSse2: return SolveContactsSse2;
+  case SimdLevel::kAvx2: return SolveContactsAvx2;
+#endif
+  default: return nullptr;
+  }
+}
+
+Float SolveContacts(BodyStorage& bodies, ContactBatch* batches, size_t count) {
+  static const ContactKernel kernel = GetContactKernel(DetectSimdLevel());
+  return kernel(bodies, batches, count);
+}
+
+}
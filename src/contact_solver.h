@@ -0,0 +1,65 @@
+#pragma once
+
+#include "base/math.h"
+#include "base/simd.h"
+#include "body_storage.h"
+#include "collision.h"
+#include <cstddef>
+
+namespace apollonia {
+
+// The contacts of up to kLanes arbiters sharing no dynamic body, as
+// structure of arrays so the lanes are solved together by vector code.
+// A lane holds the points of one arbiter, they are solved in order.
+struct ContactBatch {
+  static const size_t kLanes = 8;
+  static const size_t kPoints = Arbiter::kMaxContacts;
+
+  // Run PreStep of the arbiters, which warm starts them, and load their
+  // contacts in the lanes. The unused lanes and points do nothing.
+  void PreStep(BodyStorage& bodies, Float dt);
+  // Write the accumulated impulses back for the warm start of next step
+  void Store() const;
+
+  size_t count {0};
+  Arbiter* arbiter[kLanes];
+  BodyId a[kLanes];
+  BodyId b[kLanes];
+
+  Float normal_x[kLanes];
+  Float normal_y[kLanes];
+  Float tangent_x[kLanes];
+  Float tangent_y[kLanes];
+  Float friction[kLanes];
+  Float inv_mass_a[kLanes];
+  Float inv_mass_b[kLanes];
+  Float inv_inertia_a[kLanes];
+  Float inv_inertia_b[kLanes];
+
+  struct Point {
+    Float ra_x[kLanes];
+    Float ra_y[kLanes];
+    Float rb_x[kLanes];
+    Float rb_y[kLanes];
+    Float mass_normal[kLanes];
+    Float mass_tangent[kLanes];
+    Float bias[kLanes];
+    Float pn[kLanes];
+    Float pt[kLanes];
+  };
+  Point points[kPoints];
+};
+
+// Run one iteration over 'count' batches and return the largest change of
+// an accumulated impulse. A dynamic body must not appear in two lanes of
+// a batch. Static bodies are not written.
+using ContactKernel = Float (*)(BodyStorage& bodies, ContactBatch* batches,
+                                size_t count);
+
+// Return nullptr if the level is not built in
+ContactKernel GetContactKernel(SimdLevel level);
+
+// Run the kernel of the detected level
+Float SolveContacts(BodyStorage& bodies, ContactBatch* batches, size_t count);
+
+}
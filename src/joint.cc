@@ -1,40 +1,41 @@
 #include "joint.h"
 #include "body.h"
+#include <algorithm>
+#include <cmath>
 
 namespace apollonia {
 
 RevoluteJoint::RevoluteJoint(Body& a, Body& b, const Vec2& anchor)
-    : Joint(a, b), anchor_(anchor) {
-  local_anchor_a_ = a.rotation().Transpose() * (anchor_ - a.LocalToWorld(a.centroid()));
-  local_anchor_b_ = b.rotation().Transpose() * (anchor_ - b.LocalToWorld(b.centroid()));
+    : Joint(kType, a, b), anchor_(anchor) {
+  local_anchor_a_ = a.rotation().Inv() * (anchor_ - a.LocalToWorld(a.centroid()));
+  local_anchor_b_ = b.rotation().Inv() * (anchor_ - b.LocalToWorld(b.centroid()));
 }
 
-void RevoluteJoint::PreStep(Float dt) {
+void RevoluteJoint::PreStep(BodyStorage& bodies, Float dt) {
   static const Float kBiasFactor = 0.2;
-  auto& a = this->a();
-  auto& b = this->b();
-  ra_ = a.rotation() * local_anchor_a_;
-  rb_ = b.rotation() * local_anchor_b_;
-  auto k = (a.inv_mass() + b.inv_mass()) * Mat22::I +
-           a.inv_inertia() * Mat22(ra_.y*ra_.y, -ra_.y*ra_.x, -ra_.y*ra_.x, ra_.x*ra_.x) +
-           b.inv_inertia() * Mat22(rb_.y*rb_.y, -rb_.y*rb_.x, -rb_.y*rb_.x, rb_.x*rb_.x);
+  auto a = ia_ = this->a().id();
+  auto b = ib_ = this->b().id();
+  ra_ = bodies.rotation[a] * local_anchor_a_;
+  rb_ = bodies.rotation[b] * local_anchor_b_;
+  auto k = (bodies.inv_mass[a] + bodies.inv_mass[b]) * Mat22::I +
+           bodies.inv_inertia[a] * Mat22(ra_.y*ra_.y, -ra_.y*ra_.x, -ra_.y*ra_.x, ra_.x*ra_.x) +
+           bodies.inv_inertia[b] * Mat22(rb_.y*rb_.y, -rb_.y*rb_.x, -rb_.y*rb_.x, rb_.x*rb_.x);
   mass_ = k.Inv();
-  bias_ = -kBiasFactor / dt * (b.LocalToWorld(b.centroid()) + rb_ - a.LocalToWorld(a.centroid()) - ra_);
+  bias_ = -kBiasFactor / dt * ((bodies.position[b] + bodies.centroid[b]) + rb_ -
+                               (bodies.position[a] + bodies.centroid[a]) - ra_);
 
-  a.ApplyImpulse(-p_, ra_);
-  b.ApplyImpulse(p_, rb_);
+  bodies.ApplyImpulse(a, -p_, ra_);
+  bodies.ApplyImpulse(b, p_, rb_);
 }
 
-void RevoluteJoint::ApplyImpulse() {
-  auto& a = this->a();
-  auto& b = this->b();
-  auto dv = (b.velocity() + Cross(b.angular_velocity(), rb_)) -
-            (a.velocity() + Cross(a.angular_velocity(), ra_));
+Float RevoluteJoint::ApplyImpulse(BodyStorage& bodies) {
+  auto dv = bodies.VelocityAt(ib_, rb_) - bodies.VelocityAt(ia_, ra_);
   auto p = mass_ * (-1 * dv + bias_);
 
-  a.ApplyImpulse(-p, ra_);
-  b.ApplyImpulse(p, rb_);
+  bodies.ApplyImpulse(ia_, -p, ra_);
+  bodies.ApplyImpulse(ib_, p, rb_);
   p_ += p;
+  return std::max(std::abs(p.x), std::abs(p.y));
 }
 
 }
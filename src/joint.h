@@ -8,35 +8,45 @@ namespace apollonia {
 
 class World;
 
+// Tag of the concrete joint. The world keeps the joints of each type in
+// their own pool and runs them in loops over a single type, so a joint
+// type only needs non virtual PreStep() and ApplyImpulse(), which returns
+// the largest change of its accumulated impulse. A new type takes an enum
+// value, a case in VisitJointType() and a pool in World::joint_pools_.
+enum class JointType : uint8_t {
+  kRevolute,
+};
+static const size_t kNumJointTypes = 1;
+
 class Joint {
  public:
   friend class World;
-  // Prev step before iteration, reduce calculation
-  virtual void PreStep(Float dt) = 0;
-
-  // Apply impluse to maintain constrains
-  virtual void ApplyImpulse() = 0;
 
+  JointType type() const { return type_; }
   Body& a() { return a_; }
   const Body& a() const { return a_; }
   Body& b() { return b_; }
   const Body& b() const { return b_; }
 
  protected:
-  Joint(Body& a, Body& b) : a_(a), b_(b) {}
-  virtual ~Joint() {}
+  Joint(JointType type, Body& a, Body& b) : a_(a), b_(b), type_(type) {}
+  ~Joint() {}
   DISABLE_COPY_AND_ASSIGN(Joint)
 
  private:
   Body& a_;
   Body& b_;
+  JointType type_;
 };
 
 class RevoluteJoint : public Joint {
  public:
   friend class World;
-  void PreStep(Float dt) override;
-  void ApplyImpulse() override;
+  static const JointType kType = JointType::kRevolute;
+  // Prev step before iteration, reduce calculation
+  void PreStep(BodyStorage& bodies, Float dt);
+  // Apply impluse to maintain constrains
+  Float ApplyImpulse(BodyStorage& bodies);
 
   const Vec2& anchor() const { return anchor_; }
   Vec2 WorldAnchorA() const {
@@ -58,6 +68,8 @@ class RevoluteJoint : public Joint {
   Vec2 local_anchor_b_;
 
   // Cached status in prev step
+  BodyId ia_;
+  BodyId ib_;
   // Anchor point to body a' centroid
   Vec2 ra_;
   // Anchor point to body b' centroid
@@ -70,4 +82,36 @@ class RevoluteJoint : public Joint {
   Vec2 bias_;
 };
 
+template <typename T>
+struct JointTag {
+  using Type = T;
+};
+
+// Call 'func(JointTag<T>())' with the class T of the joint type 'type'.
+// This is the only switch over the joint types, the code handling each
+// type goes through it.
+template <typename Func>
+void VisitJointType(JointType type, Func&& func) {
+  switch (type) {
+  case JointType::kRevolute:
+    func(JointTag<RevoluteJoint>());
+    break;
+  }
+}
+
+// Call 'func(joint)' with the joint cast to its class
+template <typename Func>
+void VisitJoint(Joint& joint, Func&& func) {
+  VisitJointType(joint.type(), [&](auto tag) {
+    func(static_cast<typename decltype(tag)::Type&>(joint));
+  });
+}
+
+template <typename Func>
+void VisitJoint(const Joint& joint, Func&& func) {
+  VisitJointType(joint.type(), [&](auto tag) {
+    func(static_cast<const typename decltype(tag)::Type&>(joint));
+  });
+}
+
 }
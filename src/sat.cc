@@ -0,0 +1,149 @@
+#include "sat.h"
+#include <type_traits>
+
+// This file is built without floating point contraction, every level
+// rounds '(x - ox) * nx + (y - oy) * ny' the same way.
+
+namespace apollonia {
+
+static_assert(std::is_same<Float, float>::value, "The kernels work on float");
+
+// Turn -0 into +0, the vector min does not order the signed zeros the way
+// std::min does.
+static inline Float Canonical(Float x) {
+  return x + 0.0f;
+}
+
+static inline Float MinScalar(Float min_sep, const Float* xs, const Float* ys,
+                              size_t begin, size_t end, const Vec2& va,
+                              const Vec2& normal) {
+  for (size_t j = begin; j < end; ++j) {
+    Float sep = (xs[j] - va.x) * normal.x + (ys[j] - va.y) * normal.y;
+    min_sep = std::min(min_sep, sep);
+  }
+  return min_sep;
+}
+
+static Float FindMaxSeparationScalar(const Vec2* vertices, const Vec2* normals,
+                                     size_t count, const Float* xs, const Float* ys,
+                                     size_t other_count, size_t& idx) {
+  Float separation = -kInf;
+  for (size_t i = 0; i < count; ++i) {
+    auto min_sep = Canonical(MinScalar(kInf, xs, ys, 0, other_count,
+                                       vertices[i], normals[i]));
+    if (min_sep > separation) {
+      separation = min_sep;
+      idx = i;
+    }
+  }
+  return separation;
+}
+
+#ifdef APOLLONIA_X86
+
+// The vector kernels put consecutive edges of A in the lanes and walk the
+// vertices of B, so no horizontal reduction is needed for the minimums.
+// Then the lanes are visited in edge order to keep the first maximum.
+
+static inline void PickMax(const Float* min_sep, size_t base, size_t lanes,
+                           Float& separation, size_t& idx) {
+  for (size_t k = 0; k < lanes; ++k) {
+    auto sep = Canonical(min_sep[k]);
+    if (sep > separation) {
+      separation = sep;
+      idx = base + k;
+    }
+  }
+}
+
+APOLLONIA_TARGET("sse2")
+static inline void MinSeparation4(const Vec2* vertices, const Vec2* normals,
+                                  const Float* xs, const Float* ys,
+                                  size_t other_count, Float* min_sep) {
+  auto ox = _mm_setr_ps(vertices[0].x, vertices[1].x, vertices[2].x, vertices[3].x);
+  auto oy = _mm_setr_ps(vertices[0].y, vertices[1].y, vertices[2].y, vertices[3].y);
+  auto nx = _mm_setr_ps(normals[0].x, normals[1].x, normals[2].x, normals[3].x);
+  auto ny = _mm_setr_ps(normals[0].y, normals[1].y, normals[2].y, normals[3].y);
+  auto min4 = _mm_set1_ps(kInf);
+  for (size_t j = 0; j < other_count; ++j) {
+    auto dx = _mm_sub_ps(_mm_set1_ps(xs[j]), ox);
+    auto dy = _mm_sub_ps(_mm_set1_ps(ys[j]), oy);
+    min4 = _mm_min_ps(min4, _mm_add_ps(_mm_mul_ps(dx, nx), _mm_mul_ps(dy, ny)));
+  }
+  _mm_storeu_ps(min_sep, min4);
+}
+
+APOLLONIA_TARGET("sse2")
+static Float FindMaxSeparationSse2(const Vec2* vertices, const Vec2* normals,
+                                   size_t count, const Float* xs, const Float* ys,
+                                   size_t other_count, size_t& idx) {
+  Float separation = -kInf;
+  Float min_sep[4];
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    MinSeparation4(vertices + i, normals + i, xs, ys, other_count, min_sep);
+    PickMax(min_sep, i, 4, separation, idx);
+  }
+  for (; i < count; ++i) {
+    min_sep[0] = MinScalar(kInf, xs, ys, 0, other_count, vertices[i], normals[i]);
+    PickMax(min_sep, i, 1, separation, idx);
+  }
+  return separation;
+}
+
+APOLLONIA_TARGET("avx2")
+static Float FindMaxSeparationAvx2(const Vec2* vertices, const Vec2* normals,
+                                   size_t count, const Float* xs, const Float* ys,
+                                   size_t other_count, size_t& idx) {
+  Float separation = -kInf;
+  Float min_sep[8];
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    auto v = vertices + i;
+    auto n = normals + i;
+    auto ox = _mm256_setr_ps(v[0].x, v[1].x, v[2].x, v[3].x, v[4].x, v[5].x, v[6].x, v[7].x);
+    auto oy = _mm256_setr_ps(v[0].y, v[1].y, v[2].y, v[3].y, v[4].y, v[5].y, v[6].y, v[7].y);
+    auto nx = _mm256_setr_ps(n[0].x, n[1].x, n[2].x, n[3].x, n[4].x, n[5].x, n[6].x, n[7].x);
+    auto ny = _mm256_setr_ps(n[0].y, n[1].y, n[2].y, n[3].y, n[4].y, n[5].y, n[6].y, n[7].y);
+    auto min8 = _mm256_set1_ps(kInf);
+    for (size_t j = 0; j < other_count; ++j) {
+      auto dx = _mm256_sub_ps(_mm256_set1_ps(xs[j]), ox);
+      auto dy = _mm256_sub_ps(_mm256_set1_ps(ys[j]), oy);
+      auto sep = _mm256_add_ps(_mm256_mul_ps(dx, nx), _mm256_mul_ps(dy, ny));
+      min8 = _mm256_min_ps(min8, sep);
+    }
+    _mm256_storeu_ps(min_sep, min8);
+    PickMax(min_sep, i, 8, separation, idx);
+  }
+  for (; i + 4 <= count; i += 4) {
+    MinSeparation4(vertices + i, normals + i, xs, ys, other_count, min_sep);
+    PickMax(min_sep, i, 4, separation, idx);
+  }
+  for (; i < count; ++i) {
+    min_sep[0] = MinScalar(kInf, xs, ys, 0, other_count, vertices[i], normals[i]);
+    PickMax(min_sep, i, 1, separation, idx);
+  }
+  return separation;
+}
+
+#endif
+
+SatKernel GetSatKernel(SimdLevel level) {
+  switch (level) {
+  case SimdLevel::kScalar: return FindMaxSeparationScalar;
+#ifdef APOLLONIA_X86
+  case SimdLevel::kSse2: return FindMaxSeparationSse2;
+  case SimdLevel::kAvx2: return FindMaxSeparationAvx2;
+#endif
+  default: return nullptr;
+  }
+}
+
+Float FindMaxSeparation(const Vec2* vertices, const Vec2* normals, size_t count,
+                        const Float* xs, const Float* ys, size_t other_count,
+                        size_t& idx) {
+  static const SatKernel kernel = GetSatKernel(DetectSimdLevel());
+  return kernel(vertices, normals, count, xs, ys, other_count, idx);
+}
+
+}
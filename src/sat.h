@@ -0,0 +1,27 @@
+#pragma once
+
+#include "base/math.h"
+#include "base/simd.h"
+#include <cstddef>
+
+namespace apollonia {
+
+// Separating axis kernel. For every edge 'i' of polygon A, given by its
+// first vertex and outward normal, find the minimum separation of the
+// vertices of polygon B along the normal. Return the maximum of them and
+// its edge in 'idx'. The vertices of B are passed as structure of arrays.
+//
+// All levels return bit identical results.
+using SatKernel = Float (*)(const Vec2* vertices, const Vec2* normals, size_t count,
+                            const Float* xs, const Float* ys, size_t other_count,
+                            size_t& idx);
+
+// Return nullptr if the level is not built in
+SatKernel GetSatKernel(SimdLevel level);
+
+// Run the kernel of the detected level
+Float FindMaxSeparation(const Vec2* vertices, const Vec2* normals, size_t count,
+                        const Float* xs, const Float* ys, size_t other_count,
+                        size_t& idx);
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "base/allocator.h"
+#include "base/math.h"
+#include "body.h"
+#include "joint.h"
+#include <cstdint>
+
+namespace apollonia {
+
+// World space state of the bodies and joints at the end of a step, all a
+// renderer needs without touching the world.
+struct Snapshot {
+  struct BodyState {
+    ShapeType shape_type;
+    bool is_static;
+    bool awake;
+    Vec2 position;
+    Rot rotation;
+    // Circles
+    Float radius;
+    // Polygons, a range of 'vertices'
+    size_t vertex_begin;
+    size_t vertex_count;
+  };
+
+  struct JointState {
+    JointType type;
+    // Lines from the centroids of the bodies to the anchors
+    bool is_static_a;
+    bool is_static_b;
+    Vec2 centroid_a;
+    Vec2 anchor_a;
+    Vec2 centroid_b;
+    Vec2 anchor_b;
+  };
+
+  // Number of steps the world had taken
+  uint64_t step {0};
+  // In the order of World::bodies() and World::joints()
+  Vector<BodyState> bodies;
+  Vector<JointState> joints;
+  Vector<Vec2> vertices;
+};
+
+}
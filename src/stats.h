@@ -0,0 +1,70 @@
+#pragma once
+
+#include "apollonia.h"
+#include <chrono>
+#include <cstddef>
+
+namespace apollonia {
+
+// What the last World::Step did and where its time went. The solver
+// phases run per island on all workers, their times are summed over the
+// islands so they can exceed the step time. Sub-steps are summed.
+//
+// Collected only when built with APOLLONIA_STATS, otherwise all zero.
+struct StepStats {
+  double step_ms {0};
+  double broad_phase_ms {0};
+  // Collision and the arbiter cache update
+  double narrow_phase_ms {0};
+  // Building and coloring the islands
+  double islands_ms {0};
+  double pre_step_ms {0};
+  double solve_ms {0};
+  double integrate_ms {0};
+
+  // Pairs from the broad phase run through the narrow phase
+  size_t pairs_tested {0};
+  size_t arbiters_created {0};
+  size_t arbiters_persisted {0};
+  size_t arbiters_destroyed {0};
+  // Contact points of the pairs in contact
+  size_t contacts {0};
+  size_t islands {0};
+  // Velocity iterations the most demanding island ran
+  size_t iterations {0};
+  // Heap allocations made by the engine
+  size_t allocations {0};
+};
+
+#ifdef APOLLONIA_STATS
+
+// Add the time spent in the enclosing scope to 'ms'
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(double& ms) : ms_(ms), start_(Clock::now()) {}
+  ~ScopedTimer() {
+    ms_ += std::chrono::duration<double, std::milli>(Clock::now() - start_).count();
+  }
+  DISABLE_COPY_AND_ASSIGN(ScopedTimer)
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  double& ms_;
+  Clock::time_point start_;
+};
+
+#define APOLLONIA_STATS_CONCAT2(a, b) a##b
+#define APOLLONIA_STATS_CONCAT(a, b) APOLLONIA_STATS_CONCAT2(a, b)
+#define APOLLONIA_STATS_TIME(ms) \
+  ::apollonia::ScopedTimer APOLLONIA_STATS_CONCAT(scoped_timer_, __LINE__)(ms)
+#define APOLLONIA_STATS_ADD(counter, n) ((counter) += (n))
+
+#else
+
+// The arguments are not evaluated
+#define APOLLONIA_STATS_TIME(ms) ((void)0)
+#define APOLLONIA_STATS_ADD(counter, n) ((void)0)
+
+#endif
+
+}
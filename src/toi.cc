@@ -0,0 +1,125 @@
+#include "toi.h"
+#include <algorithm>
+
+namespace apollonia {
+
+using std::abs;
+
+// Largest separation of the vertices of 'b' from the edges of 'a'
+static Float MaxSeparation(const Vec2* a, size_t a_count, const Vec2* b, size_t b_count,
+                           Vec2& normal) {
+  Float max_separation = -kInf;
+  for (size_t i = 0; i < a_count; ++i) {
+    auto& v0 = a[i];
+    auto& v1 = a[(i+1)%a_count];
+    auto n = (v1 - v0).Normal();
+    auto separation = kInf;
+    for (size_t j = 0; j < b_count; ++j) {
+      separation = std::min(separation, Dot(b[j] - v0, n));
+    }
+    if (separation > max_separation) {
+      max_separation = separation;
+      normal = n;
+    }
+  }
+  return max_separation;
+}
+
+// Closest distance of the vertices of 'b' to the edges of 'a', 'normal'
+// points from the edge to the vertex
+static Float MinVertexDistance(const Vec2* a, size_t a_count, const Vec2* b,
+                               size_t b_count, Vec2& normal) {
+  auto min_distance = kInf;
+  for (size_t i = 0; i < a_count; ++i) {
+    auto& v0 = a[i];
+    auto e = a[(i+1)%a_count] - v0;
+    auto length_squared = Dot(e, e);
+    for (size_t j = 0; j < b_count; ++j) {
+      auto t = length_squared > 0 ? Dot(b[j] - v0, e) / length_squared : 0;
+      t = std::min<Float>(std::max<Float>(t, 0), 1);
+      auto d = b[j] - (v0 + e * t);
+      auto distance = d.Magnitude();
+      if (distance < min_distance && distance > 0) {
+        min_distance = distance;
+        normal = d / distance;
+      }
+    }
+  }
+  return min_distance;
+}
+
+Float PolygonDistance(const Vec2* a, size_t a_count, const Vec2* b, size_t b_count,
+                      Vec2& normal) {
+  Vec2 normal_a, normal_b;
+  auto separation_a = MaxSeparation(a, a_count, b, b_count, normal_a);
+  auto separation_b = MaxSeparation(b, b_count, a, a_count, normal_b);
+  if (separation_a <= 0 && separation_b <= 0) {
+    if (separation_a >= separation_b) {
+      normal = normal_a;
+      return separation_a;
+    }
+    normal = -normal_b;
+    return separation_b;
+  }
+  // Apart, the closest features are a vertex and an edge
+  auto distance_a = MinVertexDistance(a, a_count, b, b_count, normal_a);
+  auto distance_b = MinVertexDistance(b, b_count, a, a_count, normal_b);
+  if (distance_a <= distance_b) {
+    normal = normal_a;
+    return distance_a;
+  }
+  normal = -normal_b;
+  return distance_b;
+}
+
+Float TimeOfImpact(const Vec2* vertices, size_t count, const Vec2& centroid,
+                   const Sweep& sweep, const Vec2* other, size_t other_count,
+                   Float target, Vec2* scratch) {
+  // Within this much of the target is close enough
+  static const Float kTolerance = 0.0025;
+  static const int kMaxIterations = 20;
+  static const Float kMaxOverlap = -0.05;
+  Float radius = 0;
+  for (size_t i = 0; i < count; ++i) {
+    radius = std::max(radius, (vertices[i] - centroid).Magnitude());
+  }
+  auto translation = sweep.p1 - sweep.p0;
+  auto angular_bound = abs(sweep.angle) * radius;
+
+  Float t = 0;
+  for (int iteration = 0; iteration < kMaxIterations; ++iteration) {
+    auto position = sweep.Position(t);
+    auto rotation = sweep.Rotation(t);
+    for (size_t i = 0; i < count; ++i) {
+      scratch[i] = position + rotation * (vertices[i] - centroid) + centroid;
+    }
+    Vec2 normal;
+    auto distance = PolygonDistance(scratch, count, other, other_count, normal);
+    if (iteration == 0 && distance <= target + kTolerance) {
+      // Deep overlaps are left to the contacts. A polygon resting on
+      // 'other' has contacts too but nothing keeps it from sinking deeper
+      // over the sub-step, so it may go little deeper than it starts.
+      if (distance < kMaxOverlap) {
+        return 1;
+      }
+      target = distance - 2 * kTolerance;
+    }
+    if (distance <= target + kTolerance) {
+      return t;
+    }
+    // No point of the polygon approaches 'other' along the normal faster
+    // than this over the rest of the sweep, so the advance can not skip
+    // past the target
+    auto bound = std::max<Float>(Dot(translation, normal), 0) + angular_bound;
+    if (bound <= 0) {
+      return 1;
+    }
+    t += (distance - target) / bound;
+    if (t >= 1) {
+      return 1;
+    }
+  }
+  return t;
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "base/math.h"
+#include <cstddef>
+
+namespace apollonia {
+
+// Motion of a body over a sub-step as Integrate() moves it, the position
+// goes straight from p0 to p1 while the rotation turns by 'angle'.
+struct Sweep {
+  Vec2 p0;
+  Vec2 p1;
+  Rot r0;
+  Float angle;
+
+  // Pose at the fraction 't' of the sub-step
+  Vec2 Position(Float t) const { return p0 + (p1 - p0) * t; }
+  Rot Rotation(Float t) const { return r0.Integrated(angle * t); }
+};
+
+// Distance of two convex polygons given by their world vertices in counter
+// clockwise order. If they overlap it is the largest separation along the
+// edge normals, which is negative. 'normal' points from 'a' to 'b'.
+Float PolygonDistance(const Vec2* a, size_t a_count, const Vec2* b, size_t b_count,
+                      Vec2& normal);
+
+// Conservative advancement of a polygon moving along 'sweep' against the
+// polygon 'other', which does not move. The polygon has the local vertices
+// 'vertices' turning about 'centroid', 'scratch' takes 'count' vertices.
+// Return the fraction of the sub-step where the polygon first comes within
+// 'target' of 'other', 1 if it does not. A polygon already overlapping
+// 'other' by more than 'target' at the start is stopped before it goes
+// deeper, unless the overlap is too deep to be a resting contact.
+Float TimeOfImpact(const Vec2* vertices, size_t count, const Vec2& centroid,
+                   const Sweep& sweep, const Vec2* other, size_t other_count,
+                   Float target, Vec2* scratch);
+
+}
@@ -2,7 +2,13 @@
 #include "body.h"
 #include "collision.h"
 #include "joint.h"
+#include "stats.h"
+#include "base/trace.h"
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <new>
+#include <type_traits>
 
 namespace apollonia {
 
@@ -12,95 +18,1066 @@ World::~World() {
 
 PolygonBody* World::NewBox(Float mass,
     Float width, Float height, const Vec2& position) {
-  PolygonBody::VertexList vertices = {
-    {width/2, height/2}, {-width/2, height/2},
-    {-width/2, -height/2}, {width/2, -height/2}
-  };
-  auto body = new PolygonBody(mass, vertices);
-  body->set_position(position);
-  return body;
+  auto vertices = vertex_arena_.Allocate<Vec2>(4);
+  vertices[0] = {width/2, height/2};
+  vertices[1] = {-width/2, height/2};
+  vertices[2] = {-width/2, -height/2};
+  vertices[3] = {width/2, -height/2};
+  return NewPolygonBody(mass, vertices, 4, position);
 }
 
 PolygonBody* World::NewPolygonBody(Float mass,
     const PolygonBody::VertexList& vertices, const Vec2& position) {
-  auto body = new PolygonBody(mass, vertices);
+  auto copy = vertex_arena_.Allocate<Vec2>(vertices.size());
+  std::copy(vertices.begin(), vertices.end(), copy);
+  return NewPolygonBody(mass, copy, vertices.size(), position);
+}
+
+PolygonBody* World::NewPolygonBody(Float mass, const Vec2* vertices,
+                                   size_t count, const Vec2& position) {
+  auto body = new (polygon_pool_.Allocate())
+      PolygonBody(body_storage_, mass, vertices, count);
+  body->set_position(position);
+  return body;
+}
+
+CircleBody* World::NewCircle(Float mass, Float radius, const Vec2& position) {
+  auto body = new (circle_pool_.Allocate()) CircleBody(body_storage_, mass, radius);
   body->set_position(position);
   return body;
 }
 
 Arbiter* World::NewArbiter(Body& a, Body& b, const Vec2& normal,
                            const Arbiter::ContactList& contacts) {
-  return new Arbiter(a, b, normal, contacts);
+  return new (arbiter_pool_.Allocate()) Arbiter(a.id(), b.id(), normal, contacts);
+}
+
+void World::DeleteBody(Body* body) {
+  auto shape_type = body->shape_type();
+  body->~Body();
+  switch (shape_type) {
+  case ShapeType::kPolygon: polygon_pool_.Free(static_cast<PolygonBody*>(body)); break;
+  case ShapeType::kCircle: circle_pool_.Free(static_cast<CircleBody*>(body)); break;
+  }
+}
+
+void World::DeleteJoint(Joint* joint) {
+  VisitJoint(*joint, [this](auto& typed) {
+    using T = std::decay_t<decltype(typed)>;
+    typed.~T();
+    JointPool<T>().Free(&typed);
+  });
+}
+
+void World::DeleteArbiter(Arbiter* arbiter) {
+  arbiter->~Arbiter();
+  arbiter_pool_.Free(arbiter);
 }
 
 RevoluteJoint* World::NewRevoluteJoint(Body& a, Body& b, const Vec2& anchor) {
-  return new RevoluteJoint(a, b, anchor);
+  return NewJoint<RevoluteJoint>(a, b, anchor);
+}
+
+void World::Reserve(size_t bodies, size_t joints) {
+  bodies_.reserve(bodies);
+  joints_.reserve(joints);
+  body_storage_.Reserve(bodies, 4 * bodies);
+  if (bodies > body_storage_.size()) {
+    polygon_pool_.Reserve(bodies - body_storage_.size());
+  }
+  if (joints > joints_.size()) {
+    JointPool<RevoluteJoint>().Reserve(joints - joints_.size());
+  }
+  if (broad_phase_type_ == BroadPhaseType::kSweepAndPrune) {
+    sap_.Reserve(bodies);
+  } else {
+    tree_.Reserve(bodies);
+  }
+  ReserveStep(bodies, joints);
+}
+
+void World::ReserveStep(size_t bodies, size_t joints) {
+  bodies = std::max(bodies, step_bodies_);
+  joints = std::max(joints, step_joints_);
+  auto arbiters = kArbitersPerBody * bodies;
+  if (arbiters > arbiters_.size()) {
+    arbiter_pool_.Reserve(arbiters - arbiters_.size());
+  }
+  arbiters_.Reserve(arbiters);
+  pairs_.reserve(arbiters);
+  if (broad_phase_type_ == BroadPhaseType::kSweepAndPrune) {
+    sap_.ReservePairs(bodies, kArbitersPerBody);
+  }
+  island_parent_.reserve(bodies);
+  island_sleep_time_.reserve(bodies);
+  island_index_.reserve(bodies);
+  body_colors_.reserve(bodies);
+  islands_.reserve(bodies);
+  island_bodies_.reserve(bodies);
+  bullets_.reserve(bodies);
+  active_arbiters_.reserve(arbiters);
+  arbiter_colors_.reserve(arbiters);
+  // An overflowing contact takes a batch of its own
+  batches_.reserve(arbiters);
+  // A color holds at least one constraint
+  colors_.reserve(arbiters + joints);
+  active_joints_.reserve(joints);
+  joint_colors_.reserve(joints);
+  color_joints_.reserve(joints);
+  step_bodies_ = bodies;
+  step_joints_ = joints;
+}
+
+size_t World::AddBoxes(size_t count, const Float* masses, const Vec2* sizes,
+                       const Vec2* positions) {
+  auto vertices = vertex_arena_.Allocate<Vec2>(4 * count);
+  for (size_t i = 0; i < count; ++i) {
+    auto half = sizes[i] / 2;
+    auto box = vertices + 4 * i;
+    box[0] = {half.x, half.y};
+    box[1] = {-half.x, half.y};
+    box[2] = {-half.x, -half.y};
+    box[3] = {half.x, -half.y};
+  }
+  return AddPolygonRange(count, masses, vertices,
+                         [](size_t i) { return 4 * i; }, positions);
+}
+
+size_t World::AddPolygons(size_t count, const Float* masses, const Vec2* vertices,
+                          const size_t* offsets, const Vec2* positions) {
+  auto begin = offsets[0];
+  auto copy = vertex_arena_.Allocate<Vec2>(offsets[count] - begin);
+  std::copy(vertices + begin, vertices + offsets[count], copy);
+  return AddPolygonRange(count, masses, copy,
+                         [offsets, begin](size_t i) { return offsets[i] - begin; },
+                         positions);
+}
+
+// The same state as NewPolygonBody() and Add() one by one. Only the
+// storage is touched serially, the mass properties, world vertices and
+// bounds of each body are independent.
+template <typename Offset>
+size_t World::AddPolygonRange(size_t count, const Float* masses,
+                              const Vec2* vertices, Offset&& offset,
+                              const Vec2* positions) {
+  auto first = bodies_.size();
+  polygon_pool_.Reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    auto body = new (polygon_pool_.Allocate()) PolygonBody(
+        body_storage_, masses[i], vertices + offset(i), offset(i+1) - offset(i),
+        false);
+    body_storage_.position[body->id_] = positions[i];
+    AppendBody(body);
+  }
+  SynchronizeBodies(first, true);
+  AddProxies(first);
+  return first;
+}
+
+void World::SynchronizeBodies(size_t first, bool update_mass) {
+  static const size_t kGrain = 256;
+  auto count = bodies_.size() - first;
+  pool_.ParallelFor(count, kGrain, [=](size_t begin, size_t end) {
+    for (size_t i = first + begin; i < first + end; ++i) {
+      auto body = bodies_[i];
+      if (update_mass && body->shape_type() == ShapeType::kPolygon) {
+        static_cast<PolygonBody*>(body)->UpdateMass();
+      }
+      body->Synchronize();
+      body->aabb_ = body->Bound();
+    }
+  });
+}
+
+void World::AddProxies(size_t first) {
+  if (broad_phase_type_ == BroadPhaseType::kSweepAndPrune) {
+    auto sap_first = sap_.size();
+    for (size_t i = first; i < bodies_.size(); ++i) {
+      auto body = bodies_[i];
+      sap_.Append(body->aabb_, body->mass() == kInf, body);
+    }
+    sap_.Merge(sap_first);
+  } else {
+    for (size_t i = first; i < bodies_.size(); ++i) {
+      bodies_[i]->proxy_ = tree_.CreateProxy(bodies_[i]->aabb_, bodies_[i]);
+    }
+  }
+}
+
+void World::Add(Body* body) {
+  AppendBody(body);
+  body->aabb_ = body->Bound();
+  if (broad_phase_type_ == BroadPhaseType::kSweepAndPrune) {
+    sap_.Add(body->aabb_, body->mass() == kInf, body);
+  } else {
+    body->proxy_ = tree_.CreateProxy(body->aabb_, body);
+  }
+}
+
+void World::AppendBody(Body* body) {
+  // Simulated bodies take the front of the storage
+  auto id = static_cast<BodyId>(bodies_.size());
+  if (body->id_ != id) {
+    body_storage_.Swap(body->id_, id);
+  }
+  bodies_.push_back(body);
+}
+
+void World::RefitBroadPhase(Float dt) {
+  static const size_t kGrain = 256;
+  pool_.ParallelFor(bodies_.size(), kGrain, [this](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      // Sleeping bodies do not move
+      if (body_storage_.awake[i] || body_storage_.inv_mass[i] == 0) {
+        bodies_[i]->aabb_ = bodies_[i]->Bound();
+      }
+    }
+  });
+  if (broad_phase_type_ == BroadPhaseType::kSweepAndPrune) {
+    // The pairs of two static boxes are skipped by the sweep
+    if (body_storage_.statics_changed) {
+      for (auto& proxy : sap_.proxies_) {
+        proxy.is_static = static_cast<Body*>(proxy.user_data)->inv_mass() == 0;
+      }
+      body_storage_.statics_changed = false;
+    }
+    sap_.Update(pool_, [](void* user_data) {
+      return static_cast<Body*>(user_data)->aabb_;
+    });
+    return;
+  }
+  for (auto body : bodies_) {
+    tree_.MoveProxy(body->proxy_, body->aabb_, body->velocity() * dt);
+  }
+}
+
+void World::BroadPhase(Float dt) {
+  // Left fitted by the last step, unless bodies were moved since
+  RefitBroadPhase(dt);
+  pairs_.clear();
+  if (broad_phase_type_ == BroadPhaseType::kSweepAndPrune) {
+    sap_.FindPairs(pool_);
+    for (auto& pair : sap_.pairs()) {
+      pairs_.emplace_back(static_cast<Body*>(pair.first),
+                          static_cast<Body*>(pair.second));
+    }
+    return;
+  }
+
+  for (auto body : bodies_) {
+    // Pairs with static or sleeping bodies are reported by the other side
+    if (!body->awake()) {
+      continue;
+    }
+    tree_.Query(body->aabb_, [this, body](int proxy) {
+      auto other = static_cast<Body*>(tree_.UserData(proxy));
+      if (other == body || !other->aabb_.Overlaps(body->aabb_)) {
+        return true;
+      }
+      // Pairs of two awake bodies are reported by the smaller proxy
+      if (other->awake() && proxy < body->proxy_) {
+        return true;
+      }
+      pairs_.emplace_back(body, other);
+      return true;
+    });
+  }
+}
+
+void World::set_solver_settings(const SolverSettings& settings) {
+  assert(settings.velocity_iterations > 0 && settings.sub_steps > 0);
+  solver_settings_ = settings;
 }
 
 void World::Step(Float dt) {
-  // Collide
+  APOLLONIA_TRACE_SCOPE("Step");
+  stats_ = StepStats();
+  APOLLONIA_STATS_TIME(stats_.step_ms);
+  AllocationScope allocations;
+  if (body_storage_.size() > step_bodies_ || joints_.size() > step_joints_) {
+    ReserveStep(body_storage_.size(), joints_.size());
+  }
+  step_iterations_ = 0;
+  auto sub_dt = dt / solver_settings_.sub_steps;
+  for (size_t i = 0; i < solver_settings_.sub_steps; ++i) {
+    SubStep(sub_dt);
+  }
+  ++step_count_;
+  {
+    // Fit the broad phase to the bodies for the queries, the next step
+    // finds it fitted
+    APOLLONIA_TRACE_SCOPE("RefitBroadPhase");
+    APOLLONIA_STATS_TIME(stats_.broad_phase_ms);
+    RefitBroadPhase(sub_dt);
+  }
+  if (publish_snapshots_) {
+    PublishSnapshot();
+  }
+  step_allocations_ = allocations.count();
+  APOLLONIA_STATS_ADD(stats_.iterations, step_iterations_);
+  APOLLONIA_STATS_ADD(stats_.allocations, step_allocations_);
+}
+
+// A full copy, the polygons take the same vertex ranges as in the storage
+void World::PublishSnapshot() {
+  APOLLONIA_TRACE_SCOPE("PublishSnapshot");
+  auto& s = body_storage_;
+  auto& snapshot = snapshots_.write_buffer();
+  snapshot.step = step_count_;
+  snapshot.vertices.assign(s.world_vertices.begin(), s.world_vertices.end());
+  snapshot.bodies.resize(bodies_.size());
   for (size_t i = 0; i < bodies_.size(); ++i) {
-    for (size_t j = i + 1; j < bodies_.size(); ++j) {
-      // TODO(wgtdkp):
-      auto& a = dynamic_cast<PolygonBody&>(*bodies_[i]);
-      auto& b = dynamic_cast<PolygonBody&>(*bodies_[j]);
-      if (!a.ShouldCollide(b)) {
-        continue;
+    auto body = bodies_[i];
+    auto& state = snapshot.bodies[i];
+    state.shape_type = body->shape_type();
+    state.is_static = s.inv_mass[i] == 0;
+    state.awake = s.awake[i] != 0;
+    state.position = s.position[i];
+    state.rotation = s.rotation[i];
+    state.radius = 0;
+    state.vertex_begin = 0;
+    state.vertex_count = 0;
+    switch (body->shape_type()) {
+    case ShapeType::kPolygon: {
+      auto polygon = static_cast<PolygonBody*>(body);
+      state.vertex_begin = polygon->offset_;
+      state.vertex_count = polygon->Count();
+      break;
+    }
+    case ShapeType::kCircle:
+      state.radius = static_cast<CircleBody*>(body)->radius();
+      break;
+    }
+  }
+  snapshot.joints.resize(joints_.size());
+  for (size_t i = 0; i < joints_.size(); ++i) {
+    auto joint = joints_[i];
+    auto& state = snapshot.joints[i];
+    state.type = joint->type();
+    state.is_static_a = joint->a().inv_mass() == 0;
+    state.is_static_b = joint->b().inv_mass() == 0;
+    state.centroid_a = joint->a().LocalToWorld(joint->a().centroid());
+    state.centroid_b = joint->b().LocalToWorld(joint->b().centroid());
+    VisitJoint(*joint, [&state](const auto& typed) {
+      state.anchor_a = typed.WorldAnchorA();
+      state.anchor_b = typed.WorldAnchorB();
+    });
+  }
+  snapshots_.Publish();
+}
+
+void World::NarrowPhase() {
+  APOLLONIA_TRACE_SCOPE("NarrowPhase");
+  APOLLONIA_STATS_TIME(stats_.narrow_phase_ms);
+  auto& awake = body_storage_.awake;
+  for (auto& pair : pairs_) {
+    auto& a = *pair.first;
+    auto& b = *pair.second;
+    if (!a.ShouldCollide(b)) {
+      continue;
+    }
+    if (!awake[a.id()] && !awake[b.id()]) {
+      continue;
+    }
+    APOLLONIA_STATS_ADD(stats_.pairs_tested, 1);
+    if (!Collide(candidate_, a, b)) {
+      continue;
+    }
+    APOLLONIA_STATS_ADD(stats_.contacts, candidate_.contacts_.size());
+    // Touched by an awake body, the island is woken by UpdateIslands()
+    // so its pairs are kept until then.
+    if (!awake[a.id()]) {
+      body_storage_.sleep_time[a.id()] = 0;
+    } else if (!awake[b.id()]) {
+      body_storage_.sleep_time[b.id()] = 0;
+    }
+    ArbiterKey key(a, b);
+    auto arbiter = arbiters_.Touch(key);
+    if (arbiter != nullptr) {
+      arbiter->Update(candidate_);
+      APOLLONIA_STATS_ADD(stats_.arbiters_persisted, 1);
+    } else {
+      arbiters_.Insert(key, new (arbiter_pool_.Allocate()) Arbiter(candidate_));
+      APOLLONIA_STATS_ADD(stats_.arbiters_created, 1);
+    }
+  }
+  // Sleeping pairs are not collided, their contacts are kept as they are.
+  // A pair turned static by Body::set_mass() is never collided again.
+  arbiters_.Sweep([this](Arbiter* arbiter) {
+    auto& s = body_storage_;
+    if (!s.awake[arbiter->a_] && !s.awake[arbiter->b_] &&
+        (s.inv_mass[arbiter->a_] != 0 || s.inv_mass[arbiter->b_] != 0)) {
+      return false;
+    }
+    DeleteArbiter(arbiter);
+    APOLLONIA_STATS_ADD(stats_.arbiters_destroyed, 1);
+    return true;
+  });
+}
+
+void World::SubStep(Float dt) {
+  {
+    APOLLONIA_TRACE_SCOPE("BroadPhase");
+    APOLLONIA_STATS_TIME(stats_.broad_phase_ms);
+    BroadPhase(dt);
+  }
+  NarrowPhase();
+  {
+    APOLLONIA_TRACE_SCOPE("UpdateIslands");
+    APOLLONIA_STATS_TIME(stats_.islands_ms);
+    UpdateIslands();
+  }
+  CollectBullets();
+
+  // A big island would keep a single worker busy while the others idle,
+  // it is colored and solved by all of them.
+  static const size_t kMinColoredCost = 1024;
+  size_t num_colored = 0;
+  if (pool_.num_threads() > 1) {
+    while (num_colored < islands_.size() &&
+           islands_[num_colored].Cost() >= kMinColoredCost) {
+      SolveColoredIsland(islands_[num_colored++], dt);
+    }
+  }
+  // The islands share no bodies, each one is solved by a single worker.
+  // The big ones are scheduled first.
+  pool_.ParallelFor(islands_.size() - num_colored, 1,
+                    [this, dt, num_colored](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      SolveIsland(islands_[num_colored + i], dt);
+    }
+  });
+  size_t iterations = 0;
+  for (auto& island : islands_) {
+    iterations = std::max(iterations, island.iterations);
+    APOLLONIA_STATS_ADD(stats_.pre_step_ms, island.pre_step_ms);
+    APOLLONIA_STATS_ADD(stats_.solve_ms, island.solve_ms);
+    APOLLONIA_STATS_ADD(stats_.integrate_ms, island.integrate_ms);
+  }
+  step_iterations_ += iterations;
+  APOLLONIA_STATS_ADD(stats_.islands, islands_.size());
+  SweepBullets(dt);
+}
+
+void World::CollectBullets() {
+  auto& s = body_storage_;
+  bullets_.clear();
+  for (size_t i = 0; i < bodies_.size(); ++i) {
+    if (s.bullet[i] && s.awake[i] && bodies_[i]->shape_type() == ShapeType::kPolygon) {
+      bullets_.push_back({static_cast<BodyId>(i), s.position[i], s.rotation[i]});
+    }
+  }
+}
+
+void World::SweepBullets(Float dt) {
+  if (bullets_.empty()) {
+    return;
+  }
+  APOLLONIA_TRACE_SCOPE("SweepBullets");
+  // Stop inside the allowed penetration, so the next narrow phase makes
+  // contacts but the solver does not push the bullet back out
+  static const Float kTarget = -0.005;
+  auto& s = body_storage_;
+  for (auto& start : bullets_) {
+    auto id = start.id;
+    auto bullet = static_cast<PolygonBody*>(bodies_[id]);
+    Sweep sweep {start.position, s.position[id], start.rotation,
+                 s.angular_velocity[id] * dt};
+    // The bound of the broad phase is the start pose
+    auto swept = AABB::Union(bullet->aabb_, bullet->Bound());
+    toi_vertices_.resize(bullet->Count());
+    Float min_t = 1;
+    auto visit = [&](Body* other) {
+      if (other->mass() != kInf || other->shape_type() != ShapeType::kPolygon ||
+          !other->aabb_.Overlaps(swept)) {
+        return true;
       }
-      auto arbiter = Collide(&a, &b);
-      auto iter = arbiters_.find({a, b});
-      if (arbiter == nullptr) {
-        if (iter != arbiters_.end()) {
-          delete iter->second;
-          arbiters_.erase(iter);
-        }
-      } else if (iter == arbiters_.end()) {
-        arbiters_[*arbiter] = arbiter;
-      } else {
-        auto& old_arbiter = iter->second;
-        arbiter->AccumulateImpulse(*old_arbiter);
-        delete old_arbiter;
-        old_arbiter = arbiter;
+      auto polygon = static_cast<PolygonBody*>(other);
+      auto t = TimeOfImpact(bullet->vertices_, bullet->Count(), bullet->centroid(),
+                            sweep, polygon->world_vertices(), polygon->Count(),
+                            kTarget, toi_vertices_.data());
+      min_t = std::min(min_t, t);
+      return true;
+    };
+    if (broad_phase_type_ == BroadPhaseType::kSweepAndPrune) {
+      sap_.Query(swept, [&](void* user_data) {
+        return visit(static_cast<Body*>(user_data));
+      });
+    } else {
+      tree_.Query(swept, [&](int proxy) {
+        return visit(static_cast<Body*>(tree_.UserData(proxy)));
+      });
+    }
+    if (min_t < 1) {
+      s.position[id] = sweep.Position(min_t);
+      s.rotation[id] = sweep.Rotation(min_t);
+      bullet->Synchronize();
+    }
+  }
+}
+
+BodyId World::FindIsland(BodyId id) {
+  while (island_parent_[id] != id) {
+    // Path halving
+    island_parent_[id] = island_parent_[island_parent_[id]];
+    id = island_parent_[id];
+  }
+  return id;
+}
+
+void World::UnionIslands(BodyId a, BodyId b) {
+  auto& inv_mass = body_storage_.inv_mass;
+  // Static bodies do not connect islands
+  if (inv_mass[a] == 0 || inv_mass[b] == 0) {
+    return;
+  }
+  a = FindIsland(a);
+  b = FindIsland(b);
+  if (a != b) {
+    island_parent_[std::max(a, b)] = std::min(a, b);
+  }
+}
+
+void World::UpdateIslands() {
+  auto& s = body_storage_;
+  auto n = bodies_.size();
+  island_parent_.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    island_parent_[i] = static_cast<BodyId>(i);
+  }
+  arbiters_.ForEach([this](Arbiter& arbiter) {
+    UnionIslands(arbiter.a_, arbiter.b_);
+  });
+  for (auto joint : joints_) {
+    UnionIslands(joint->a().id(), joint->b().id());
+  }
+
+  island_sleep_time_.assign(n, kInf);
+  for (size_t i = 0; i < n; ++i) {
+    if (s.inv_mass[i] != 0) {
+      auto& sleep_time = island_sleep_time_[FindIsland(i)];
+      sleep_time = std::min(sleep_time, s.sleep_time[i]);
+    }
+  }
+  // An island sleeps and wakes as a whole
+  for (size_t i = 0; i < n; ++i) {
+    if (s.inv_mass[i] == 0) {
+      continue;
+    }
+    if (island_sleep_time_[FindIsland(i)] >= time_to_sleep_) {
+      if (s.awake[i]) {
+        s.Sleep(i);
       }
+    } else if (!s.awake[i]) {
+      s.Wake(i);
     }
   }
 
-  for (auto& kv : arbiters_) {
-    kv.second->PreStep(dt);
+  // Number the awake islands, the root of an island is its smallest id
+  island_index_.resize(n);
+  islands_.clear();
+  for (size_t i = 0; i < n; ++i) {
+    if (s.awake[i] && FindIsland(i) == i) {
+      island_index_[i] = islands_.size();
+      islands_.emplace_back();
+    }
   }
+  // Group the awake bodies and the constraints touching them by island
+  // with a counting sort
+  auto IslandOf = [this](BodyId a, BodyId b) -> Island& {
+    auto id = body_storage_.awake[a] ? a : b;
+    return islands_[island_index_[FindIsland(id)]];
+  };
+  for (size_t i = 0; i < n; ++i) {
+    if (s.awake[i]) {
+      ++IslandOf(i, i).body_end;
+    }
+  }
+  arbiters_.ForEach([this, &IslandOf](Arbiter& arbiter) {
+    if (body_storage_.awake[arbiter.a_] || body_storage_.awake[arbiter.b_]) {
+      ++IslandOf(arbiter.a_, arbiter.b_).arbiter_end;
+    }
+  });
+  for (auto joint : joints_) {
+    if (joint->a().awake() || joint->b().awake()) {
+      ++IslandOf(joint->a().id(), joint->b().id()).joint_end;
+    }
+  }
+  size_t num_bodies = 0, num_arbiters = 0, num_joints = 0;
+  for (auto& island : islands_) {
+    island.body_begin = num_bodies;
+    num_bodies += island.body_end;
+    island.body_end = island.body_begin;
+    island.arbiter_begin = num_arbiters;
+    num_arbiters += island.arbiter_end;
+    island.arbiter_end = island.arbiter_begin;
+    island.joint_begin = num_joints;
+    num_joints += island.joint_end;
+    island.joint_end = island.joint_begin;
+  }
+  island_bodies_.resize(num_bodies);
+  active_arbiters_.resize(num_arbiters);
+  active_joints_.resize(num_joints);
+  for (size_t i = 0; i < n; ++i) {
+    if (s.awake[i]) {
+      island_bodies_[IslandOf(i, i).body_end++] = static_cast<BodyId>(i);
+    }
+  }
+  arbiters_.ForEach([this, &IslandOf](Arbiter& arbiter) {
+    if (body_storage_.awake[arbiter.a_] || body_storage_.awake[arbiter.b_]) {
+      active_arbiters_[IslandOf(arbiter.a_, arbiter.b_).arbiter_end++] = &arbiter;
+    }
+  });
   for (auto joint : joints_) {
-    joint->PreStep(dt);
+    if (joint->a().awake() || joint->b().awake()) {
+      active_joints_[IslandOf(joint->a().id(), joint->b().id()).joint_end++] = joint;
+    }
+  }
+
+  std::sort(islands_.begin(), islands_.end(), [](const Island& a, const Island& b) {
+    return a.Cost() > b.Cost();
+  });
+  colors_.clear();
+  batches_.clear();
+  body_colors_.resize(n);
+  for (auto& island : islands_) {
+    ColorIsland(island);
   }
+}
 
-  // Apply impulse
-  for (size_t i = 0; i < iterations_; ++i) {
-    for (auto& kv : arbiters_) {
-      kv.second->ApplyImpulse();
+void World::SolveIsland(Island& island, Float dt) {
+  APOLLONIA_TRACE_SCOPE("SolveIsland");
+  {
+    APOLLONIA_STATS_TIME(island.pre_step_ms);
+    for (auto c = island.color_begin; c < island.color_end; ++c) {
+      auto& color = colors_[c];
+      for (auto i = color.batch_begin; i < color.batch_end; ++i) {
+        batches_[i].PreStep(body_storage_, dt);
+      }
+      ForEachJoint(color, color.joint_offsets.front(), color.joint_offsets.back(),
+                   [this, dt](auto& joint) {
+        joint.PreStep(body_storage_, dt);
+      });
+    }
+  }
+
+  {
+    APOLLONIA_STATS_TIME(island.solve_ms);
+    // Apply impulse until the impulses settle
+    island.iterations = 0;
+    while (island.iterations < solver_settings_.velocity_iterations) {
+      ++island.iterations;
+      Float residual = 0;
+      for (auto c = island.color_begin; c < island.color_end; ++c) {
+        auto& color = colors_[c];
+        residual = std::max(residual, SolveContacts(
+            body_storage_, batches_.data() + color.batch_begin,
+            color.batch_end - color.batch_begin));
+        ForEachJoint(color, color.joint_offsets.front(), color.joint_offsets.back(),
+                     [this, &residual](auto& joint) {
+          residual = std::max(residual, joint.ApplyImpulse(body_storage_));
+        });
+      }
+      if (residual < solver_settings_.tolerance) {
+        break;
+      }
     }
-    for (auto joint : joints_) {
-      joint->ApplyImpulse();
+    for (auto i = island.batch_begin; i < island.batch_end; ++i) {
+      batches_[i].Store();
     }
   }
 
-  // Integration
-  for (auto body : bodies_) {
-    body->Integrate(gravity_, dt);
+  APOLLONIA_STATS_TIME(island.integrate_ms);
+  Integrate(island.body_begin, island.body_end, dt);
+}
+
+// Greedy coloring in the order of the constraints, static bodies are
+// only read by the solver and take no colors. The arbiters of a color
+// fill the batches lane by lane, the ones of the last color may share
+// bodies and take a batch each.
+void World::ColorIsland(Island& island) {
+  auto& inv_mass = body_storage_.inv_mass;
+  auto ColorOf = [this, &inv_mass](BodyId a, BodyId b) {
+    auto dynamic_a = inv_mass[a] != 0;
+    auto dynamic_b = inv_mass[b] != 0;
+    uint32_t used = (dynamic_a ? body_colors_[a] : 0) |
+                    (dynamic_b ? body_colors_[b] : 0);
+    size_t color = 0;
+    while (color < kNumColors - 1 && (used & (1u << color))) {
+      ++color;
+    }
+    if (color < kNumColors - 1) {
+      body_colors_[a] |= dynamic_a ? 1u << color : 0;
+      body_colors_[b] |= dynamic_b ? 1u << color : 0;
+    }
+    return static_cast<uint8_t>(color);
+  };
+
+  for (auto i = island.body_begin; i < island.body_end; ++i) {
+    body_colors_[island_bodies_[i]] = 0;
   }
+  auto num_arbiters = island.arbiter_end - island.arbiter_begin;
+  auto num_joints = island.joint_end - island.joint_begin;
+  arbiter_colors_.resize(num_arbiters);
+  joint_colors_.resize(num_joints);
+  // The joints are sorted by color, then by type
+  std::array<size_t, kNumColors> arbiter_counts;
+  std::array<size_t, kNumColors * kNumJointTypes> joint_counts;
+  arbiter_counts.fill(0);
+  joint_counts.fill(0);
+  for (size_t i = 0; i < num_arbiters; ++i) {
+    auto arbiter = active_arbiters_[island.arbiter_begin + i];
+    arbiter_colors_[i] = ColorOf(arbiter->a_, arbiter->b_);
+    ++arbiter_counts[arbiter_colors_[i]];
+  }
+  for (size_t i = 0; i < num_joints; ++i) {
+    auto joint = active_joints_[island.joint_begin + i];
+    joint_colors_[i] = ColorOf(joint->a().id(), joint->b().id());
+    ++joint_counts[joint_colors_[i] * kNumJointTypes + size_t(joint->type())];
+  }
+
+  // Lay out the non empty colors, a color index maps to its first batch
+  // and joint slot.
+  std::array<size_t, kNumColors> batch_cursors;
+  std::array<size_t, kNumColors * kNumJointTypes> joint_cursors;
+  island.color_begin = colors_.size();
+  island.batch_begin = batches_.size();
+  auto num_batches = island.batch_begin;
+  auto joint_offset = island.joint_begin;
+  for (size_t c = 0; c < kNumColors; ++c) {
+    batch_cursors[c] = num_batches;
+    auto joints = joint_counts.begin() + c * kNumJointTypes;
+    if (arbiter_counts[c] == 0 &&
+        std::all_of(joints, joints + kNumJointTypes, [](size_t n) { return n == 0; })) {
+      continue;
+    }
+    Color color;
+    color.batch_begin = num_batches;
+    num_batches += c < kNumColors - 1 ?
+        (arbiter_counts[c] + ContactBatch::kLanes - 1) / ContactBatch::kLanes :
+        arbiter_counts[c];
+    color.batch_end = num_batches;
+    for (size_t t = 0; t < kNumJointTypes; ++t) {
+      color.joint_offsets[t] = joint_offset;
+      joint_cursors[c * kNumJointTypes + t] = joint_offset - island.joint_begin;
+      joint_offset += joints[t];
+    }
+    color.joint_offsets[kNumJointTypes] = joint_offset;
+    color.overflow = c == kNumColors - 1;
+    colors_.push_back(color);
+  }
+  island.color_end = colors_.size();
+  island.batch_end = num_batches;
+
+  batches_.resize(num_batches);
+  for (size_t i = 0; i < num_arbiters; ++i) {
+    auto c = arbiter_colors_[i];
+    auto& batch = batches_[batch_cursors[c]];
+    batch.arbiter[batch.count++] = active_arbiters_[island.arbiter_begin + i];
+    if (c == kNumColors - 1 || batch.count == ContactBatch::kLanes) {
+      ++batch_cursors[c];
+    }
+  }
+  // Counting sort of the joints, keeping the order inside a color and type
+  color_joints_.resize(num_joints);
+  for (size_t i = 0; i < num_joints; ++i) {
+    auto joint = active_joints_[island.joint_begin + i];
+    auto key = joint_colors_[i] * kNumJointTypes + size_t(joint->type());
+    color_joints_[joint_cursors[key]++] = joint;
+  }
+  std::copy(color_joints_.begin(), color_joints_.end(),
+            active_joints_.begin() + island.joint_begin);
 }
 
-void World::Clear() {
-  for (auto& kv : arbiters_) {
-    delete kv.second;
+template <typename T, typename Func>
+void World::ForEachJoint(size_t begin, size_t end, Func&& func) {
+  for (auto i = begin; i < end; ++i) {
+    func(static_cast<T&>(*active_joints_[i]));
   }
-  arbiters_.clear();
+}
+
+template <typename Func>
+void World::ForEachJoint(const Color& color, size_t begin, size_t end, Func&& func) {
+  for (size_t t = 0; t < kNumJointTypes; ++t) {
+    auto type_begin = std::max(begin, color.joint_offsets[t]);
+    auto type_end = std::min(end, color.joint_offsets[t+1]);
+    if (type_begin >= type_end) {
+      continue;
+    }
+    VisitJointType(JointType(t), [&](auto tag) {
+      ForEachJoint<typename decltype(tag)::Type>(type_begin, type_end, func);
+    });
+  }
+}
+
+// Run the functions on the batches and joints of each color in parallel.
+// The constraints of the last color may share bodies, they are run in
+// order on this thread.
+template <typename BatchFunc, typename JointFunc>
+void World::ForEachColor(const Island& island, BatchFunc&& batch_func,
+                         JointFunc&& joint_func) {
+  // About 64 constraints per task
+  static const size_t kGrain = 8;
+  for (auto c = island.color_begin; c < island.color_end; ++c) {
+    auto& color = colors_[c];
+    auto batches = batches_.data() + color.batch_begin;
+    auto num_batches = color.batch_end - color.batch_begin;
+    auto joint_begin = color.joint_offsets.front();
+    auto n = num_batches + color.joint_offsets.back() - joint_begin;
+    pool_.ParallelFor(n, color.overflow ? n : kGrain, [&](size_t begin, size_t end) {
+      if (begin < num_batches) {
+        batch_func(batches + begin, std::min(end, num_batches) - begin);
+      }
+      if (end > num_batches) {
+        ForEachJoint(color, joint_begin + std::max(begin, num_batches) - num_batches,
+                     joint_begin + end - num_batches, joint_func);
+      }
+    });
+  }
+}
+
+static void AtomicMax(std::atomic<Float>& max, Float value) {
+  auto current = max.load(std::memory_order_relaxed);
+  while (value > current &&
+         !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+// The constraints of a color touch distinct dynamic bodies, the result
+// does not depend on which worker solves them. The residual is a maximum,
+// so neither does the number of iterations.
+void World::SolveColoredIsland(Island& island, Float dt) {
+  APOLLONIA_TRACE_SCOPE("SolveColoredIsland");
+  static const size_t kGrain = 256;
+  {
+    APOLLONIA_STATS_TIME(island.pre_step_ms);
+    ForEachColor(island, [this, dt](ContactBatch* batches, size_t count) {
+      for (size_t i = 0; i < count; ++i) {
+        batches[i].PreStep(body_storage_, dt);
+      }
+    }, [this, dt](auto& joint) {
+      joint.PreStep(body_storage_, dt);
+    });
+  }
+
+  {
+    APOLLONIA_STATS_TIME(island.solve_ms);
+    // Apply impulse until the impulses settle
+    island.iterations = 0;
+    while (island.iterations < solver_settings_.velocity_iterations) {
+      ++island.iterations;
+      std::atomic<Float> residual {0};
+      ForEachColor(island, [this, &residual](ContactBatch* batches, size_t count) {
+        AtomicMax(residual, SolveContacts(body_storage_, batches, count));
+      }, [this, &residual](auto& joint) {
+        AtomicMax(residual, joint.ApplyImpulse(body_storage_));
+      });
+      if (residual.load() < solver_settings_.tolerance) {
+        break;
+      }
+    }
+    pool_.ParallelFor(island.batch_end - island.batch_begin, kGrain / ContactBatch::kLanes,
+                      [this, &island](size_t begin, size_t end) {
+      for (auto i = begin; i < end; ++i) {
+        batches_[island.batch_begin + i].Store();
+      }
+    });
+  }
+
+  APOLLONIA_STATS_TIME(island.integrate_ms);
+  pool_.ParallelFor(island.body_end - island.body_begin, kGrain,
+                    [this, &island, dt](size_t begin, size_t end) {
+    Integrate(island.body_begin + begin, island.body_begin + end, dt);
+  });
+}
+
+// Stream through the state of the bodies, they are in increasing order
+// of id inside an island.
+void World::Integrate(size_t begin, size_t end, Float dt) {
+  auto& s = body_storage_;
+  static const Float kLinearSleepTolerance = 0.01;
+  static const Float kAngularSleepTolerance = 2.0 / 180 * kPi;
+  for (auto k = begin; k < end; ++k) {
+    auto i = island_bodies_[k];
+    auto& v = s.velocity[i];
+    auto& w = s.angular_velocity[i];
+    v += (gravity_ + s.force[i] * s.inv_mass[i]) * dt;
+    w += (s.torque[i] * s.inv_inertia[i]) * dt;
+    // Resting is judged by the velocities moving the body
+    if (Dot(v, v) > kLinearSleepTolerance * kLinearSleepTolerance ||
+        w * w > kAngularSleepTolerance * kAngularSleepTolerance) {
+      s.sleep_time[i] = 0;
+    } else {
+      s.sleep_time[i] += dt;
+    }
+    s.position[i] += v * dt;
+    s.rotation[i] = s.rotation[i].Integrated(w * dt);
+  }
+
+  // Refresh the world space shapes for the next step and the renderer
+  for (auto k = begin; k < end; ++k) {
+    bodies_[island_bodies_[k]]->Synchronize();
+  }
+}
+
+void World::RayCastClosest(size_t count, const Ray* rays, RayHit* hits) {
+  APOLLONIA_TRACE_SCOPE("RayCastClosest");
+  static const size_t kGrain = 64;
+  pool_.ParallelFor(count, kGrain, [this, rays, hits](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      auto& closest = hits[i];
+      closest = RayHit();
+      CastRay(rays[i], [&closest](const RayHit& hit) {
+        closest = hit;
+        return hit.fraction;
+      });
+    }
+  });
+}
+
+void World::set_state_capacity(size_t capacity) {
+  states_.resize(capacity);
+  for (auto& state : states_) {
+    if (!state) {
+      state.reset(new WorldState());
+    }
+  }
+  next_state_ = 0;
+}
+
+uint64_t World::SaveState() {
+  assert(!states_.empty());
+  auto& state = *states_[next_state_];
+  next_state_ = (next_state_ + 1) % states_.size();
+  auto& s = body_storage_;
+  state.valid = true;
+  state.step = step_count_;
+  state.num_bodies = bodies_.size();
+  state.num_joints = joints_.size();
+  state.velocity = s.velocity;
+  state.angular_velocity = s.angular_velocity;
+  state.awake = s.awake;
+  state.position = s.position;
+  state.rotation = s.rotation;
+  state.force = s.force;
+  state.torque = s.torque;
+  state.sleep_time = s.sleep_time;
+  state.world_vertices = s.world_vertices;
+  state.world_normals = s.world_normals;
+  state.world_x = s.world_x;
+  state.world_y = s.world_y;
+  state.aabb.resize(bodies_.size());
+  for (size_t i = 0; i < bodies_.size(); ++i) {
+    state.aabb[i] = bodies_[i]->aabb_;
+  }
+  if (broad_phase_type_ == BroadPhaseType::kSweepAndPrune) {
+    state.sap.CopyFrom(sap_);
+  } else {
+    state.tree.CopyFrom(tree_);
+  }
+  // Reserved first, the slots point into the array
+  state.arbiters.clear();
+  state.arbiters.reserve(arbiters_.size());
+  state.arbiter_cache.CopyFrom(arbiters_, [&state](Arbiter* arbiter) {
+    state.arbiters.push_back(*arbiter);
+    return &state.arbiters.back();
+  });
+  state.joint_impulses.resize(joints_.size());
+  for (size_t i = 0; i < joints_.size(); ++i) {
+    VisitJoint(*joints_[i], [&state, i](const auto& typed) {
+      state.joint_impulses[i] = typed.p_;
+    });
+  }
+  return state.step;
+}
+
+bool World::RestoreState(uint64_t step) {
+  size_t idx = 0;
+  while (idx < states_.size() &&
+         !(states_[idx]->valid && states_[idx]->step == step)) {
+    ++idx;
+  }
+  if (idx == states_.size()) {
+    return false;
+  }
+  auto& state = *states_[idx];
+  auto& s = body_storage_;
+  if (state.num_bodies != bodies_.size() || state.position.size() != s.size() ||
+      state.num_joints != joints_.size()) {
+    return false;
+  }
+  // The saves after it are of steps being undone
+  for (auto& other : states_) {
+    other->valid = other->valid && other->step <= step;
+  }
+  next_state_ = (idx + 1) % states_.size();
+
+  step_count_ = state.step;
+  s.velocity = state.velocity;
+  s.angular_velocity = state.angular_velocity;
+  s.awake = state.awake;
+  s.position = state.position;
+  s.rotation = state.rotation;
+  s.force = state.force;
+  s.torque = state.torque;
+  s.sleep_time = state.sleep_time;
+  s.world_vertices = state.world_vertices;
+  s.world_normals = state.world_normals;
+  s.world_x = state.world_x;
+  s.world_y = state.world_y;
+  for (size_t i = 0; i < bodies_.size(); ++i) {
+    bodies_[i]->aabb_ = state.aabb[i];
+  }
+  if (broad_phase_type_ == BroadPhaseType::kSweepAndPrune) {
+    sap_.CopyFrom(state.sap);
+    // The masses are not part of the state, they may have changed since
+    body_storage_.statics_changed = true;
+  } else {
+    tree_.CopyFrom(state.tree);
+  }
+  arbiters_.ForEach([this](Arbiter& arbiter) { DeleteArbiter(&arbiter); });
+  arbiters_.CopyFrom(state.arbiter_cache, [this](Arbiter* arbiter) {
+    return new (arbiter_pool_.Allocate()) Arbiter(*arbiter);
+  });
+  for (size_t i = 0; i < joints_.size(); ++i) {
+    VisitJoint(*joints_[i], [&state, i](auto& typed) {
+      typed.p_ = state.joint_impulses[i];
+    });
+  }
+  if (publish_snapshots_) {
+    PublishSnapshot();
+  }
+  return true;
+}
+
+void World::Clear() {
+  arbiters_.ForEach([this](Arbiter& arbiter) { DeleteArbiter(&arbiter); });
+  arbiters_.Clear();
   for (auto joint : joints_) {
-    delete joint;
+    DeleteJoint(joint);
   }
   joints_.clear();
-  for (auto body : bodies_) {
-    delete body;
+  // Also release the bodies never added
+  for (auto body : body_storage_.body) {
+    DeleteBody(body);
   }
+  body_storage_.Clear();
   bodies_.clear();
+  vertex_arena_.Reset();
+  tree_.Clear();
+  sap_.Clear();
+  pairs_.clear();
+  islands_.clear();
+  island_bodies_.clear();
+  active_arbiters_.clear();
+  active_joints_.clear();
+  colors_.clear();
+  batches_.clear();
+  for (auto& state : states_) {
+    state->valid = false;
+  }
+  if (publish_snapshots_) {
+    PublishSnapshot();
+  }
 }
 
 };
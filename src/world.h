@@ -1,56 +1,426 @@
 #pragma once
 
 #include "apollonia.h"
+#include "arbiter_cache.h"
+#include "base/allocator.h"
+#include "base/arena.h"
 #include "base/math.h"
+#include "base/pool.h"
+#include "base/thread_pool.h"
+#include "base/triple_buffer.h"
 #include "body.h"
+#include "body_storage.h"
+#include "broad_phase.h"
 #include "collision.h"
+#include "contact_solver.h"
 #include "joint.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "toi.h"
+#include "world_state.h"
 
-#include <vector>
-#include <map>
+#include <array>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 namespace apollonia {
 
+enum class BroadPhaseType {
+  // Dynamic AABB tree, good for scenes of mixed sizes
+  kTree,
+  // Parallel sort and sweep, good for dense piles of similar bodies
+  kSweepAndPrune,
+};
+
+struct SolverSettings {
+  // Velocity iterations of each sub-step
+  size_t velocity_iterations {10};
+  // Step(dt) runs this many steps of dt / sub_steps, collision included
+  size_t sub_steps {1};
+  // An island stops iterating once no accumulated impulse changes by this
+  // much in an iteration, 0 always runs all of them
+  Float tolerance {0};
+};
+
 class World {
  public:
   using BodyList = std::vector<Body*>;
   using JointList = std::vector<Joint*>;
-  using ArbiterList = std::map<ArbiterKey, Arbiter*>;
+  using ArbiterList = ArbiterCache;
+  using PairList = Vector<std::pair<Body*, Body*>>;
 
-  World(const Vec2& gravity) : gravity_(gravity) {}
+  // Independent islands are solved concurrently by 'num_threads' workers,
+  // including the thread calling Step().
+  World(const Vec2& gravity, BroadPhaseType broad_phase=BroadPhaseType::kTree,
+        size_t num_threads=ThreadPool::DefaultNumThreads())
+      : pool_(num_threads), gravity_(gravity), broad_phase_type_(broad_phase) {}
   ~World();
-  static PolygonBody* NewBox(Float mass, Float width, Float height,
-                             const Vec2& position={0, 0});
-  static PolygonBody* NewPolygonBody(Float mass, const PolygonBody::VertexList& vertices,
-                                     const Vec2& position={0, 0});
-  static Arbiter* NewArbiter(Body& a, Body& b, const Vec2& normal,
+  // Bodies and joints are stored in pools of the world, they can only
+  // be added to the world creating them and are released by Clear().
+  PolygonBody* NewBox(Float mass, Float width, Float height,
+                      const Vec2& position={0, 0});
+  PolygonBody* NewPolygonBody(Float mass, const PolygonBody::VertexList& vertices,
+                              const Vec2& position={0, 0});
+  CircleBody* NewCircle(Float mass, Float radius, const Vec2& position={0, 0});
+  Arbiter* NewArbiter(Body& a, Body& b, const Vec2& normal,
       const Arbiter::ContactList& contacts=Arbiter::ContactList());
-  static RevoluteJoint* NewRevoluteJoint(Body& a, Body& b, const Vec2& anchor);
+  RevoluteJoint* NewRevoluteJoint(Body& a, Body& b, const Vec2& anchor);
+  // Room for 'bodies' polygons and 'joints' joints in total, so creating
+  // them does not regrow the storage. The vertex cache is sized for boxes,
+  // the step buffers for a few contacts per body.
+  void Reserve(size_t bodies, size_t joints=0);
+  // Create and add 'count' boxes at once, box 'i' has masses[i], sizes[i]
+  // as width and height and positions[i]. The bodies take contiguous
+  // slots and ids, their mass properties and world vertices are computed
+  // by the workers. Return the index in bodies() of the first, the state
+  // is the same as adding them one by one.
+  size_t AddBoxes(size_t count, const Float* masses, const Vec2* sizes,
+                  const Vec2* positions);
+  // Like AddBoxes(), polygon 'i' has the local vertices
+  // [offsets[i], offsets[i+1]) of 'vertices'.
+  size_t AddPolygons(size_t count, const Float* masses, const Vec2* vertices,
+                     const size_t* offsets, const Vec2* positions);
 
-  void Add(Body* body) { bodies_.push_back(body); }
+  void Add(Body* body);
   void Add(Joint* joint) { joints_.push_back(joint); }
   const Vec2& gravity() const { return gravity_; }
+  BroadPhaseType broad_phase_type() const { return broad_phase_type_; }
+  size_t num_threads() const { return pool_.num_threads(); }
   const BodyList& bodies() const { return bodies_; }
   const JointList& joints() const { return joints_; }
+  // Islands of bodies resting for this long go to sleep, kInf disables
+  // sleeping
+  Float time_to_sleep() const { return time_to_sleep_; }
+  void set_time_to_sleep(Float time_to_sleep) { time_to_sleep_ = time_to_sleep; }
+  const SolverSettings& solver_settings() const { return solver_settings_; }
+  void set_solver_settings(const SolverSettings& settings);
+  // Velocity iterations run by the last step, the most any island needed
+  // summed over the sub-steps
+  size_t step_iterations() const { return step_iterations_; }
+  // Timings and counters of the last step, all zero unless the library is
+  // built with APOLLONIA_STATS
+  const StepStats& stats() const { return stats_; }
+  // Heap allocations made by the engine in the last step, by the thread
+  // calling Step() and the workers, zero once the pools and buffers have
+  // warmed up.
+  size_t step_allocations() const { return step_allocations_; }
 
   void Step(Float dt);
   void Clear();
+  // Steps run since the world was created
+  uint64_t step_count() const { return step_count_; }
+
+  // Rollback. SaveState() copies the dynamic state into a ring of the
+  // last 'capacity' saves: the body transforms, velocities, forces and
+  // sleep times, the broad phase, the arbiters with their accumulated
+  // impulses and the joint impulses. Stepping from a restored state
+  // reproduces the original steps exactly. The bodies, joints and their
+  // properties must not have changed since the save.
+  //
+  // The ring is allocated by set_state_capacity(), a save copies into the
+  // storage of the oldest one and allocates nothing once it is warm.
+  size_t state_capacity() const { return states_.size(); }
+  void set_state_capacity(size_t capacity);
+  // Save the state and return its step_count()
+  uint64_t SaveState();
+  // Go back to the state saved at 'step', the saves after it are dropped.
+  // Return false if it is not in the ring or the bodies changed.
+  bool RestoreState(uint64_t step);
+
+  // Write the bodies, joints and, with 'arbiters', the warm start cache to
+  // a flat binary checkpoint, see world_file.h. Return false if the file
+  // can not be written.
+  bool SaveFile(const char* path, bool arbiters=true) const;
+  // Replace the content of the world by a checkpoint. The file is mapped
+  // and the stored mass properties are taken as they are. With the saved
+  // arbiters, a world of the saved broad phase type steps on bit for bit
+  // like the saved one. A world of the other type builds its broad phase
+  // anew. Return false, leaving the world untouched, if the file is not a
+  // valid checkpoint of this version.
+  bool LoadFile(const char* path);
+  // Scene queries. The bodies are found through the broad phase, which
+  // each step leaves fitted to where the bodies end up. A body moved by
+  // its setters since is found where it was. The queries do not allocate.
+  // They must not run concurrently with each other or with Step().
+  //
+  // Call 'callback(Body&)' for each body whose bounding box overlaps
+  // 'aabb', the query stops when it returns false.
+  template <typename Callback>
+  void QueryAABB(const AABB& aabb, Callback&& callback);
+  // Call 'callback(Body&)' for each body containing 'point', the query
+  // stops when it returns false.
+  template <typename Callback>
+  void QueryPoint(const Vec2& point, Callback&& callback);
+  // Call 'callback(const RayHit&)' for the bodies 'ray' enters, in no
+  // particular order. The callback returns the fraction to clip the ray
+  // to: 0 stops, hit.fraction finds the closest, 1 goes on unclipped.
+  template <typename Callback>
+  void RayCast(const Ray& ray, Callback&& callback);
+  // Closest hit of each of the 'count' rays in 'hits', the body of the
+  // hit is null if the ray hits nothing. The rays are split over the
+  // workers.
+  void RayCastClosest(size_t count, const Ray* rays, RayHit* hits);
+
+  // Serialize the calls changing the world, a renderer reads snapshots
+  // instead.
   void Lock() { mutex_.lock(); }
   void Unlock() { mutex_.unlock(); }
 
+  // Publish a snapshot at the end of every step and clear, off by default
+  bool publish_snapshots() const { return publish_snapshots_; }
+  void set_publish_snapshots(bool publish) { publish_snapshots_ = publish; }
+  // The latest snapshot published, without locking. A single thread may
+  // read them, the snapshot is valid until its next call.
+  const Snapshot& ReadSnapshot() { return snapshots_.Read(); }
+
  private:
-  // TODO(wgtdkp):
-  void BroadPhase();
+  // Size the arbiter cache and the buffers of the step for 'bodies' and
+  // 'joints', a step starts with it when bodies were added since
+  void ReserveStep(size_t bodies, size_t joints);
+  // Collide, solve and integrate once over 'dt'
+  void SubStep(Float dt);
+  // Refit the tree and collect the pairs whose bounding boxes overlap
+  void BroadPhase(Float dt);
+  // Bound the awake and static bodies and move their boxes in the broad
+  // phase, a tree leaf is stretched by the motion over 'dt'
+  void RefitBroadPhase(Float dt);
+  // Collide the pairs, the arbiters of pairs not in contact are evicted
+  void NarrowPhase();
+  // Bodies connected by contacts and joints, with the constraints
+  // touching them. The ranges index island_bodies_, active_arbiters_,
+  // active_joints_, colors_ and batches_.
+  struct Island {
+    size_t body_begin {0};
+    size_t body_end {0};
+    size_t arbiter_begin {0};
+    size_t arbiter_end {0};
+    size_t joint_begin {0};
+    size_t joint_end {0};
+    size_t color_begin {0};
+    size_t color_end {0};
+    size_t batch_begin {0};
+    size_t batch_end {0};
+    // Velocity iterations run in the last sub-step
+    size_t iterations {0};
+    // Times of the last sub-step, see StepStats
+    double pre_step_ms {0};
+    double solve_ms {0};
+    double integrate_ms {0};
+
+    size_t Cost() const {
+      return (arbiter_end - arbiter_begin) + (joint_end - joint_begin) +
+             (body_end - body_begin);
+    }
+  };
+
+  // Constraints of an island sharing no dynamic body. The contacts are
+  // packed in batches_ and the joints take a range of active_joints_.
+  struct Color {
+    size_t batch_begin {0};
+    size_t batch_end {0};
+    // The joints of type 't' take [joint_offsets[t], joint_offsets[t+1])
+    // of active_joints_
+    std::array<size_t, kNumJointTypes + 1> joint_offsets {};
+    // The last color, its constraints may share bodies
+    bool overflow {false};
+  };
+
+  // Union the bodies connected by contacts and joints, put the islands
+  // resting long enough to sleep, group and color the awake ones.
+  void UpdateIslands();
+  BodyId FindIsland(BodyId id);
+  void UnionIslands(BodyId a, BodyId b);
+  // Run the solver and integrate the bodies of one island
+  void SolveIsland(Island& island, Float dt);
+  // Split the constraints of an island into colors sharing no dynamic
+  // body, the contacts of a color fill the lanes of the solver batches.
+  void ColorIsland(Island& island);
+  // Solve the colors of a big island one after another, the constraints
+  // of each color in parallel.
+  void SolveColoredIsland(Island& island, Float dt);
+  template <typename BatchFunc, typename JointFunc>
+  void ForEachColor(const Island& island, BatchFunc&& batch_func,
+                    JointFunc&& joint_func);
+  // Run 'func' on the joints [begin, end) of active_joints_, the loops are
+  // over a single joint type so the calls are not virtual.
+  template <typename T, typename Func>
+  void ForEachJoint(size_t begin, size_t end, Func&& func);
+  template <typename Func>
+  void ForEachJoint(const Color& color, size_t begin, size_t end, Func&& func);
+  void PublishSnapshot();
+  // Integrate the bodies [begin, end) of island_bodies_
+  void Integrate(size_t begin, size_t end, Float dt);
+  // Remember the start pose of the awake bullets
+  void CollectBullets();
+  // Sweep the bullets from their start pose to the integrated one against
+  // the static polygons, a bullet hitting one is moved back to the time
+  // of impact and the rest of the sub-step is dropped.
+  void SweepBullets(Float dt);
+  PolygonBody* NewPolygonBody(Float mass, const Vec2* vertices,
+                              size_t count, const Vec2& position);
+  // Polygon 'i' takes the vertices [offset(i), offset(i+1)), they are
+  // owned by the world
+  template <typename Offset>
+  size_t AddPolygonRange(size_t count, const Float* masses, const Vec2* vertices,
+                         Offset&& offset, const Vec2* positions);
+  // Move the state of 'body' to the next id of the simulated bodies and
+  // list it, the broad phase is left to the caller
+  void AppendBody(Body* body);
+  // Synchronize and bound the bodies listed from 'first' on in parallel.
+  // With 'update_mass' the mass properties of the polygons are computed
+  // first.
+  void SynchronizeBodies(size_t first, bool update_mass);
+  // Add the bodies listed from 'first' on to the broad phase
+  void AddProxies(size_t first);
+  template <typename Callback>
+  void CastRay(const Ray& ray, Callback&& callback) const;
+  void DeleteBody(Body* body);
+  void DeleteJoint(Joint* joint);
+  // Pool of the joints of class 'T'
+  template <typename T>
+  ObjectPool<T>& JointPool() { return std::get<ObjectPool<T>>(joint_pools_); }
+  template <typename T>
+  T* NewJoint(Body& a, Body& b, const Vec2& anchor) {
+    return new (JointPool<T>().Allocate()) T(a, b, anchor);
+  }
+  void DeleteArbiter(Arbiter* arbiter);
   DISABLE_COPY_AND_ASSIGN(World)
 
   std::mutex mutex_;
+  ThreadPool pool_;
 
   Vec2 gravity_ {0, 0};
-  size_t iterations_ {10};
+  BroadPhaseType broad_phase_type_ {BroadPhaseType::kTree};
+  SolverSettings solver_settings_;
+  Float time_to_sleep_ {0.5};
+  BodyStorage body_storage_;
   BodyList bodies_;
   JointList joints_;
   ArbiterList arbiters_;
+  // Scratch arbiter filled by the narrow phase
+  Arbiter candidate_;
+  AABBTree tree_;
+  SweepAndPrune sap_;
+  // Candidate pairs of current step
+  PairList pairs_;
+  // Union find parent of the simulated bodies, static bodies are in no
+  // island
+  Vector<BodyId> island_parent_;
+  // Minimum sleep time of the bodies of the island rooted at each body
+  Vector<Float> island_sleep_time_;
+  // The last color takes the constraints overflowing the others
+  static const size_t kNumColors = 32;
+  // Colors taken by the constraints of each body, a bit per color
+  Vector<uint32_t> body_colors_;
+  // Colors of the constraints of the island being colored
+  Vector<uint8_t> arbiter_colors_;
+  Vector<uint8_t> joint_colors_;
+  Vector<Joint*> color_joints_;
+  // Non empty colors of the awake islands, grouped by island
+  Vector<Color> colors_;
+  Vector<ContactBatch> batches_;
+  // Index in islands_ of the island rooted at each body
+  Vector<size_t> island_index_;
+  // Awake islands, largest first
+  Vector<Island> islands_;
+  Vector<BodyId> island_bodies_;
+  // Constraints of the awake islands, grouped by island
+  Vector<Arbiter*> active_arbiters_;
+  Vector<Joint*> active_joints_;
+  // Start pose of the awake bullets in the current sub-step
+  struct BulletStart {
+    BodyId id;
+    Vec2 position;
+    Rot rotation;
+  };
+  Vector<BulletStart> bullets_;
+  // Vertices of a bullet at a time of impact iteration
+  Vector<Vec2> toi_vertices_;
+  // Contacts per body expected by ReserveStep(), a stacked box touches
+  // two to four others
+  static const size_t kArbitersPerBody = 4;
+  // Bodies and joints the step buffers are sized for
+  size_t step_bodies_ {0};
+  size_t step_joints_ {0};
+  size_t step_allocations_ {0};
+  size_t step_iterations_ {0};
+  StepStats stats_;
+  uint64_t step_count_ {0};
+  bool publish_snapshots_ {false};
+  TripleBuffer<Snapshot> snapshots_;
+  // Ring of saved states, the next save goes to 'next_state_'
+  Vector<std::unique_ptr<WorldState>> states_;
+  size_t next_state_ {0};
+
+  ObjectPool<PolygonBody> polygon_pool_;
+  ObjectPool<CircleBody> circle_pool_;
+  // A pool per joint type
+  std::tuple<ObjectPool<RevoluteJoint>> joint_pools_;
+  ObjectPool<Arbiter> arbiter_pool_;
+  // Local vertices of the polygons
+  Arena vertex_arena_;
 };
 
+// The tree leaves are fat, the bodies are checked against their tight
+// boxes. The boxes of the sweep and prune are tight.
+template <typename Callback>
+void World::QueryAABB(const AABB& aabb, Callback&& callback) {
+  auto visit = [&](Body* body) {
+    if (!body->aabb_.Overlaps(aabb)) {
+      return true;
+    }
+    return static_cast<bool>(callback(*body));
+  };
+  if (broad_phase_type_ == BroadPhaseType::kSweepAndPrune) {
+    sap_.Query(aabb, [&](void* user_data) {
+      return visit(static_cast<Body*>(user_data));
+    });
+  } else {
+    tree_.Query(aabb, [&](int proxy) {
+      return visit(static_cast<Body*>(tree_.UserData(proxy)));
+    });
+  }
+}
+
+template <typename Callback>
+void World::QueryPoint(const Vec2& point, Callback&& callback) {
+  QueryAABB(AABB(point, point), [&](Body& body) {
+    if (!body.Contains(point)) {
+      return true;
+    }
+    return static_cast<bool>(callback(body));
+  });
+}
+
+template <typename Callback>
+void World::RayCast(const Ray& ray, Callback&& callback) {
+  CastRay(ray, callback);
+}
+
+// Read only, the batch runs it concurrently
+template <typename Callback>
+void World::CastRay(const Ray& ray, Callback&& callback) const {
+  auto visit = [&](Body* body, Float max_fraction) {
+    RayHit hit;
+    if (!body->RayCast(ray, max_fraction, hit)) {
+      return max_fraction;
+    }
+    hit.body = body;
+    return static_cast<Float>(callback(static_cast<const RayHit&>(hit)));
+  };
+  if (broad_phase_type_ == BroadPhaseType::kSweepAndPrune) {
+    sap_.RayCast(ray.p1, ray.p2, 1, [&](void* user_data, Float max_fraction) {
+      return visit(static_cast<Body*>(user_data), max_fraction);
+    });
+  } else {
+    tree_.RayCast(ray.p1, ray.p2, 1, [&](int proxy, Float max_fraction) {
+      return visit(static_cast<Body*>(tree_.UserData(proxy)), max_fraction);
+    });
+  }
+}
+
 }
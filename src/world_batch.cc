@@ -0,0 +1,49 @@
+#include "world_batch.h"
+#include "base/trace.h"
+#include <algorithm>
+
+namespace apollonia {
+
+WorldBatch::WorldBatch(size_t num_worlds, const Vec2& gravity,
+                       BroadPhaseType broad_phase, size_t num_threads)
+    : pool_(num_threads) {
+  worlds_.reserve(num_worlds);
+  for (size_t i = 0; i < num_worlds; ++i) {
+    worlds_.emplace_back(new World(gravity, broad_phase, 1));
+  }
+}
+
+void WorldBatch::Step(Float dt) {
+  APOLLONIA_TRACE_SCOPE("WorldBatch::Step");
+  ResizeStates();
+  pool_.ParallelFor(worlds_.size(), 1, [this, dt](size_t begin, size_t end) {
+    for (auto i = begin; i < end; ++i) {
+      worlds_[i]->Step(dt);
+      ReadStates(i);
+    }
+  });
+}
+
+void WorldBatch::ResizeStates() {
+  size_t stride = 0;
+  for (auto& world : worlds_) {
+    stride = std::max(stride, world->bodies().size());
+  }
+  if (stride != stride_ || states_.size() != stride * worlds_.size()) {
+    stride_ = stride;
+    states_.assign(stride * worlds_.size(), BodyState());
+  }
+}
+
+void WorldBatch::ReadStates(size_t idx) {
+  auto& bodies = worlds_[idx]->bodies();
+  auto rows = states_.data() + idx * stride_;
+  for (size_t j = 0; j < bodies.size(); ++j) {
+    auto& body = *bodies[j];
+    rows[j] = {body.position(), body.rotation(), body.velocity(),
+               body.angular_velocity()};
+  }
+  std::fill(rows + bodies.size(), rows + stride_, BodyState());
+}
+
+}
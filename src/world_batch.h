@@ -0,0 +1,83 @@
+#pragma once
+
+#include "apollonia.h"
+#include "base/allocator.h"
+#include "base/math.h"
+#include "base/thread_pool.h"
+#include "world.h"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace apollonia {
+
+// Many small independent worlds stepped together, e.g. for training or
+// what-if runs. Each world runs on a single thread. The batch hands the
+// worlds out through the pool's shared counter one at a time rather than
+// stealing work: a worker done with a world claims the next one, so a
+// slow world only holds up the worker stepping it. A world is never
+// split, one much larger than the rest bounds the step time.
+//
+// After every step the bodies of all worlds are copied into one strided
+// buffer: the body 'j' of world 'i' is states()[i * stride() + j].
+class WorldBatch {
+ public:
+  struct BodyState {
+    Vec2 position;
+    Rot rotation;
+    Vec2 velocity;
+    Float angular_velocity;
+  };
+
+  WorldBatch(size_t num_worlds, const Vec2& gravity,
+             BroadPhaseType broad_phase=BroadPhaseType::kTree,
+             size_t num_threads=ThreadPool::DefaultNumThreads());
+  DISABLE_COPY_AND_ASSIGN(WorldBatch)
+
+  size_t size() const { return worlds_.size(); }
+  size_t num_threads() const { return pool_.num_threads(); }
+  World& world(size_t idx) { return *worlds_[idx]; }
+  const World& world(size_t idx) const { return *worlds_[idx]; }
+
+  // Run 'func(world, idx)' on every world in parallel, e.g. to build a
+  // differently seeded scene in each. The states are refreshed after it.
+  template <typename Func>
+  void ForEach(Func&& func);
+
+  // Step every world by 'dt' and refresh the states
+  void Step(Float dt);
+
+  // Rows of each world in the states buffer, the most bodies of any world.
+  // The rows past the bodies of a world are zero, with identity rotations.
+  size_t stride() const { return stride_; }
+  const BodyState* states() const { return states_.data(); }
+  const BodyState* states(size_t idx) const { return states_.data() + idx * stride_; }
+
+ private:
+  // Resize the buffer to the largest world and clear it if it changed
+  void ResizeStates();
+  // Copy the bodies of world 'idx' into its rows
+  void ReadStates(size_t idx);
+
+  ThreadPool pool_;
+  std::vector<std::unique_ptr<World>> worlds_;
+  size_t stride_ {0};
+  Vector<BodyState> states_;
+};
+
+template <typename Func>
+void WorldBatch::ForEach(Func&& func) {
+  pool_.ParallelFor(worlds_.size(), 1, [&](size_t begin, size_t end) {
+    for (auto i = begin; i < end; ++i) {
+      func(*worlds_[i], i);
+    }
+  });
+  ResizeStates();
+  pool_.ParallelFor(worlds_.size(), 1, [this](size_t begin, size_t end) {
+    for (auto i = begin; i < end; ++i) {
+      ReadStates(i);
+    }
+  });
+}
+
+}
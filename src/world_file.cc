@@ -0,0 +1,607 @@
+#include "world.h"
+#include "world_file.h"
+#include "base/mapped_file.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+namespace apollonia {
+
+static_assert(std::is_trivially_copyable<BodyFileRecord>::value &&
+              std::is_trivially_copyable<JointFileRecord>::value &&
+              std::is_trivially_copyable<ArbiterFileRecord>::value,
+              "The records are read in place");
+
+static const uint64_t kSectionAlign = 16;
+
+static uint64_t AlignSection(uint64_t offset) {
+  return (offset + kSectionAlign - 1) & ~(kSectionAlign - 1);
+}
+
+// Write 'size' bytes at 'offset', padding from the end of the last write
+static bool WriteSection(FILE* file, uint64_t& end, uint64_t offset,
+                         const void* data, size_t size) {
+  static const char kPadding[kSectionAlign] = {};
+  if (fwrite(kPadding, 1, offset - end, file) != offset - end) {
+    return false;
+  }
+  end = offset + size;
+  return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+bool World::SaveFile(const char* path, bool arbiters) const {
+  auto& s = body_storage_;
+  Vector<BodyFileRecord> body_records(bodies_.size());
+  Vector<Vec2> vertices;
+  for (size_t i = 0; i < bodies_.size(); ++i) {
+    auto& record = body_records[i];
+    memset(static_cast<void*>(&record), 0, sizeof(record));
+    record.shape_type = static_cast<uint8_t>(bodies_[i]->shape_type());
+    record.awake = s.awake[i];
+    record.mass = s.mass[i];
+    record.inertia = s.inertia[i];
+    record.centroid = s.centroid[i];
+    record.friction = s.friction[i];
+    record.bounce = s.bounce[i];
+    record.bullet = s.bullet[i];
+    record.position = s.position[i];
+    record.rotation = s.rotation[i];
+    record.velocity = s.velocity[i];
+    record.angular_velocity = s.angular_velocity[i];
+    record.force = s.force[i];
+    record.torque = s.torque[i];
+    record.sleep_time = s.sleep_time[i];
+    record.aabb = bodies_[i]->aabb_;
+    switch (bodies_[i]->shape_type()) {
+    case ShapeType::kPolygon: {
+      auto polygon = static_cast<const PolygonBody*>(bodies_[i]);
+      record.vertex_begin = vertices.size();
+      record.vertex_count = polygon->count_;
+      vertices.insert(vertices.end(), polygon->vertices_,
+                      polygon->vertices_ + polygon->count_);
+      break;
+    }
+    case ShapeType::kCircle:
+      record.radius = static_cast<const CircleBody*>(bodies_[i])->radius_;
+      break;
+    }
+  }
+
+  Vector<JointFileRecord> joint_records(joints_.size());
+  for (size_t i = 0; i < joints_.size(); ++i) {
+    auto& record = joint_records[i];
+    memset(static_cast<void*>(&record), 0, sizeof(record));
+    record.type = static_cast<uint8_t>(joints_[i]->type());
+    record.body_a = joints_[i]->a().id();
+    record.body_b = joints_[i]->b().id();
+    VisitJoint(*joints_[i], [&record](const auto& typed) {
+      record.anchor = typed.anchor_;
+      record.local_anchor_a = typed.local_anchor_a_;
+      record.local_anchor_b = typed.local_anchor_b_;
+      record.impulse = typed.p_;
+    });
+  }
+
+  Vector<ArbiterFileRecord> arbiter_records;
+  if (arbiters) {
+    arbiters_.ForEach([&arbiter_records](const Arbiter& arbiter) {
+      ArbiterFileRecord record;
+      memset(static_cast<void*>(&record), 0, sizeof(record));
+      record.body_a = arbiter.a_;
+      record.body_b = arbiter.b_;
+      record.normal = arbiter.normal_;
+      record.num_contacts = static_cast<uint32_t>(arbiter.contacts_.size());
+      for (size_t i = 0; i < arbiter.contacts_.size(); ++i) {
+        auto& contact = arbiter.contacts_[i];
+        auto& out = record.contacts[i];
+        out.position = contact.position;
+        out.ra = contact.ra;
+        out.rb = contact.rb;
+        out.from_a[0] = contact.from_a[0];
+        out.from_a[1] = contact.from_a[1];
+        out.indices[0] = static_cast<uint32_t>(contact.indices[0]);
+        out.indices[1] = static_cast<uint32_t>(contact.indices[1]);
+        out.separation = contact.separation;
+        out.pn = contact.pn;
+        out.pt = contact.pt;
+      }
+      arbiter_records.push_back(record);
+    });
+  }
+  // The live slots in order refer to the arbiters as numbered above
+  Vector<ArbiterSlotFileRecord> slot_records;
+  if (arbiters) {
+    uint32_t next_arbiter = 0;
+    arbiters_.ForEachUsedSlot([&](size_t slot, uint64_t key, const Arbiter* arbiter) {
+      ArbiterSlotFileRecord record;
+      memset(static_cast<void*>(&record), 0, sizeof(record));
+      record.key = key;
+      record.slot = static_cast<uint32_t>(slot);
+      record.arbiter = arbiter != nullptr ? next_arbiter++ : 0;
+      slot_records.push_back(record);
+    });
+  }
+
+  Vector<TreeNodeFileRecord> node_records;
+  Vector<SapProxyFileRecord> proxy_records;
+  if (broad_phase_type_ == BroadPhaseType::kSweepAndPrune) {
+    for (auto& proxy : sap_.proxies_) {
+      SapProxyFileRecord record;
+      memset(static_cast<void*>(&record), 0, sizeof(record));
+      record.aabb = AABB({proxy.lower_x, proxy.lower_y}, {proxy.upper_x, proxy.upper_y});
+      record.body = static_cast<const Body*>(proxy.user_data)->id();
+      proxy_records.push_back(record);
+    }
+  } else {
+    for (auto& node : tree_.nodes_) {
+      TreeNodeFileRecord record;
+      memset(static_cast<void*>(&record), 0, sizeof(record));
+      record.aabb = node.aabb;
+      record.body = node.height == 0
+          ? static_cast<int32_t>(static_cast<const Body*>(node.user_data)->id())
+          : -1;
+      record.parent = node.parent;
+      record.left = node.left;
+      record.right = node.right;
+      record.height = node.height;
+      node_records.push_back(record);
+    }
+  }
+  auto broad_phase_bytes = node_records.size() * sizeof(TreeNodeFileRecord) +
+                           proxy_records.size() * sizeof(SapProxyFileRecord);
+
+  WorldFileHeader header;
+  memset(static_cast<void*>(&header), 0, sizeof(header));
+  memcpy(header.magic, kWorldFileMagic, sizeof(header.magic));
+  header.version = kWorldFileVersion;
+  header.byte_order = kWorldFileByteOrder;
+  header.float_size = sizeof(Float);
+  header.velocity_iterations = static_cast<uint32_t>(solver_settings_.velocity_iterations);
+  header.sub_steps = static_cast<uint32_t>(solver_settings_.sub_steps);
+  header.tolerance = solver_settings_.tolerance;
+  header.gravity = gravity_;
+  header.time_to_sleep = time_to_sleep_;
+  header.step = step_count_;
+  header.num_bodies = body_records.size();
+  header.num_vertices = vertices.size();
+  header.num_joints = joint_records.size();
+  header.num_arbiters = arbiter_records.size();
+  header.arbiter_capacity = arbiters ? arbiters_.capacity() : 0;
+  header.num_arbiter_slots = slot_records.size();
+  header.broad_phase = static_cast<uint32_t>(broad_phase_type_);
+  header.tree_root = tree_.root_;
+  header.tree_free_list = tree_.free_list_;
+  header.num_broad_phase = node_records.size() + proxy_records.size();
+  header.bodies_offset = AlignSection(sizeof(header));
+  header.vertices_offset = AlignSection(
+      header.bodies_offset + body_records.size() * sizeof(BodyFileRecord));
+  header.joints_offset = AlignSection(
+      header.vertices_offset + vertices.size() * sizeof(Vec2));
+  header.arbiters_offset = AlignSection(
+      header.joints_offset + joint_records.size() * sizeof(JointFileRecord));
+  header.arbiter_slots_offset = AlignSection(
+      header.arbiters_offset + arbiter_records.size() * sizeof(ArbiterFileRecord));
+  header.broad_phase_offset = AlignSection(
+      header.arbiter_slots_offset +
+      slot_records.size() * sizeof(ArbiterSlotFileRecord));
+  header.file_size = header.broad_phase_offset + broad_phase_bytes;
+
+  auto file = fopen(path, "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  uint64_t end = 0;
+  auto ok =
+      WriteSection(file, end, 0, &header, sizeof(header)) &&
+      WriteSection(file, end, header.bodies_offset, body_records.data(),
+                   body_records.size() * sizeof(BodyFileRecord)) &&
+      WriteSection(file, end, header.vertices_offset, vertices.data(),
+                   vertices.size() * sizeof(Vec2)) &&
+      WriteSection(file, end, header.joints_offset, joint_records.data(),
+                   joint_records.size() * sizeof(JointFileRecord)) &&
+      WriteSection(file, end, header.arbiters_offset, arbiter_records.data(),
+                   arbiter_records.size() * sizeof(ArbiterFileRecord)) &&
+      WriteSection(file, end, header.arbiter_slots_offset, slot_records.data(),
+                   slot_records.size() * sizeof(ArbiterSlotFileRecord)) &&
+      (broad_phase_type_ == BroadPhaseType::kSweepAndPrune
+           ? WriteSection(file, end, header.broad_phase_offset, proxy_records.data(),
+                          broad_phase_bytes)
+           : WriteSection(file, end, header.broad_phase_offset, node_records.data(),
+                          broad_phase_bytes));
+  return fclose(file) == 0 && ok;
+}
+
+// The section of 'count' records at 'offset' lies in the file
+static bool SectionFits(const WorldFileHeader& header, uint64_t offset,
+                        uint64_t count, size_t record_size) {
+  return offset % kSectionAlign == 0 && offset <= header.file_size &&
+         count <= (header.file_size - offset) / record_size;
+}
+
+static bool Finite(Float x) { return std::isfinite(x); }
+static bool Finite(const Vec2& v) { return Finite(v.x) && Finite(v.y); }
+
+// A static body has infinite mass and inertia. Any other body has a finite
+// mass whose inverse is not zero, its inertia may be infinite to keep it
+// from turning.
+static bool ValidMassData(Float mass, Float inertia) {
+  if (mass == kInf) {
+    return inertia == kInf;
+  }
+  return Finite(mass) && mass > 0 && 1 / mass > 0 &&
+         (Finite(inertia) || inertia == kInf) && inertia > 0;
+}
+
+static bool ValidBounds(const AABB& aabb) {
+  return Finite(aabb.lower) && Finite(aabb.upper) &&
+         aabb.lower.x <= aabb.upper.x && aabb.lower.y <= aabb.upper.y;
+}
+
+// The state of a body the solver takes as it is. A static body never
+// wakes up.
+static bool ValidBody(const BodyFileRecord& record) {
+  return ValidMassData(record.mass, record.inertia) && ValidBounds(record.aabb) &&
+         Finite(record.centroid) && Finite(record.friction) &&
+         Finite(record.bounce) && Finite(record.position) &&
+         Finite(record.rotation.c) && Finite(record.rotation.s) &&
+         Finite(record.velocity) && Finite(record.angular_velocity) &&
+         Finite(record.force) && Finite(record.torque) &&
+         Finite(record.sleep_time) && record.awake <= 1 &&
+         !(record.awake && record.mass == kInf);
+}
+
+static bool ValidArbiter(const ArbiterFileRecord& record) {
+  if (!Finite(record.normal)) {
+    return false;
+  }
+  for (size_t i = 0; i < record.num_contacts; ++i) {
+    auto& contact = record.contacts[i];
+    if (!Finite(contact.position) || !Finite(contact.ra) || !Finite(contact.rb) ||
+        !Finite(contact.separation) || !Finite(contact.pn) || !Finite(contact.pt)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The nodes make a tree with a leaf for every body, as shallow as the
+// traversals need, and the other nodes are chained from the free list
+static bool ValidTree(const WorldFileHeader& header,
+                      const TreeNodeFileRecord* nodes) {
+  auto count = header.num_broad_phase;
+  auto InRange = [count](int32_t node) {
+    return node >= 0 && static_cast<uint64_t>(node) < count;
+  };
+  Vector<uint8_t> seen(count, 0);
+  Vector<uint8_t> body_seen(header.num_bodies, 0);
+  Vector<int32_t> stack;
+  uint64_t reached = 0;
+  uint64_t leaves = 0;
+  auto root = header.tree_root;
+  if (root != AABBTree::kNullNode) {
+    if (!InRange(root) || nodes[root].parent != AABBTree::kNullNode ||
+        nodes[root].height >= AABBTree::kMaxStackSize) {
+      return false;
+    }
+    stack.push_back(root);
+  }
+  while (!stack.empty()) {
+    auto idx = stack.back();
+    stack.pop_back();
+    auto& node = nodes[idx];
+    if (seen[idx] || !ValidBounds(node.aabb)) {
+      return false;
+    }
+    seen[idx] = 1;
+    ++reached;
+    if (node.left == AABBTree::kNullNode) {
+      if (node.right != AABBTree::kNullNode || node.height != 0 || node.body < 0 ||
+          static_cast<uint64_t>(node.body) >= header.num_bodies ||
+          body_seen[node.body]) {
+        return false;
+      }
+      body_seen[node.body] = 1;
+      ++leaves;
+      continue;
+    }
+    // The heights of the children are checked in turn
+    if (node.body != -1 || !InRange(node.left) || !InRange(node.right) ||
+        nodes[node.left].parent != idx || nodes[node.right].parent != idx ||
+        node.height != 1 + std::max(nodes[node.left].height,
+                                    nodes[node.right].height)) {
+      return false;
+    }
+    stack.push_back(node.left);
+    stack.push_back(node.right);
+  }
+  if (leaves != header.num_bodies) {
+    return false;
+  }
+  for (auto idx = header.tree_free_list; idx != AABBTree::kNullNode;
+       idx = nodes[idx].parent) {
+    if (!InRange(idx) || seen[idx] || nodes[idx].height != -1) {
+      return false;
+    }
+    seen[idx] = 1;
+    ++reached;
+  }
+  return reached == count;
+}
+
+// A box for every body, sorted on the lower x bound
+static bool ValidSweepAndPrune(const WorldFileHeader& header,
+                               const SapProxyFileRecord* proxies) {
+  if (header.num_broad_phase != header.num_bodies) {
+    return false;
+  }
+  Vector<uint8_t> body_seen(header.num_bodies, 0);
+  for (size_t i = 0; i < header.num_broad_phase; ++i) {
+    auto& proxy = proxies[i];
+    if (!ValidBounds(proxy.aabb) || proxy.body >= header.num_bodies ||
+        body_seen[proxy.body] ||
+        (i > 0 && proxies[i-1].aabb.lower.x > proxy.aabb.lower.x)) {
+      return false;
+    }
+    body_seen[proxy.body] = 1;
+  }
+  return true;
+}
+
+// Check everything the load indexes with or solves with, so a bad file
+// fails before the world is touched
+static bool ValidateWorldFile(const MappedFile& file) {
+  if (file.size() < sizeof(WorldFileHeader)) {
+    return false;
+  }
+  auto& header = *reinterpret_cast<const WorldFileHeader*>(file.data());
+  if (memcmp(header.magic, kWorldFileMagic, sizeof(header.magic)) != 0 ||
+      header.version != kWorldFileVersion ||
+      header.byte_order != kWorldFileByteOrder ||
+      header.float_size != sizeof(Float) || header.file_size != file.size() ||
+      header.velocity_iterations == 0 || header.sub_steps == 0 ||
+      !Finite(header.tolerance) || !Finite(header.gravity) ||
+      !(header.time_to_sleep >= 0) ||
+      header.broad_phase > static_cast<uint32_t>(BroadPhaseType::kSweepAndPrune)) {
+    return false;
+  }
+  auto tree = header.broad_phase == static_cast<uint32_t>(BroadPhaseType::kTree);
+  if (!SectionFits(header, header.bodies_offset, header.num_bodies,
+                   sizeof(BodyFileRecord)) ||
+      !SectionFits(header, header.vertices_offset, header.num_vertices,
+                   sizeof(Vec2)) ||
+      !SectionFits(header, header.joints_offset, header.num_joints,
+                   sizeof(JointFileRecord)) ||
+      !SectionFits(header, header.arbiters_offset, header.num_arbiters,
+                   sizeof(ArbiterFileRecord)) ||
+      !SectionFits(header, header.arbiter_slots_offset, header.num_arbiter_slots,
+                   sizeof(ArbiterSlotFileRecord)) ||
+      !SectionFits(header, header.broad_phase_offset, header.num_broad_phase,
+                   tree ? sizeof(TreeNodeFileRecord) : sizeof(SapProxyFileRecord))) {
+    return false;
+  }
+  auto bodies = reinterpret_cast<const BodyFileRecord*>(
+      file.data() + header.bodies_offset);
+  for (size_t i = 0; i < header.num_bodies; ++i) {
+    auto& record = bodies[i];
+    if (!ValidBody(record)) {
+      return false;
+    }
+    switch (static_cast<ShapeType>(record.shape_type)) {
+    case ShapeType::kPolygon:
+      if (record.vertex_count < 3 || record.vertex_begin > header.num_vertices ||
+          record.vertex_count > header.num_vertices - record.vertex_begin) {
+        return false;
+      }
+      break;
+    case ShapeType::kCircle:
+      if (!Finite(record.radius) || record.radius <= 0) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+    }
+  }
+  auto vertices = reinterpret_cast<const Vec2*>(file.data() + header.vertices_offset);
+  for (size_t i = 0; i < header.num_vertices; ++i) {
+    if (!Finite(vertices[i])) {
+      return false;
+    }
+  }
+  auto joints = reinterpret_cast<const JointFileRecord*>(
+      file.data() + header.joints_offset);
+  for (size_t i = 0; i < header.num_joints; ++i) {
+    auto& record = joints[i];
+    if (record.type >= kNumJointTypes || record.body_a >= header.num_bodies ||
+        record.body_b >= header.num_bodies || !Finite(record.anchor) ||
+        !Finite(record.local_anchor_a) || !Finite(record.local_anchor_b) ||
+        !Finite(record.impulse)) {
+      return false;
+    }
+  }
+  auto arbiters = reinterpret_cast<const ArbiterFileRecord*>(
+      file.data() + header.arbiters_offset);
+  for (size_t i = 0; i < header.num_arbiters; ++i) {
+    auto& record = arbiters[i];
+    if (record.body_a >= header.num_bodies || record.body_b >= header.num_bodies ||
+        record.body_a == record.body_b ||
+        record.num_contacts > Arbiter::kMaxContacts || !ValidArbiter(record)) {
+      return false;
+    }
+  }
+  // Every arbiter has the live slot of its pair
+  auto slots = reinterpret_cast<const ArbiterSlotFileRecord*>(
+      file.data() + header.arbiter_slots_offset);
+  Vector<uint8_t> arbiter_seen(header.num_arbiters, 0);
+  uint64_t live = 0;
+  auto valid_slots = ArbiterCache::ValidSlots(
+      header.arbiter_capacity, header.num_arbiter_slots,
+      [slots](size_t i) { return slots[i].slot; },
+      [slots](size_t i) { return slots[i].key; },
+      [&](size_t i) {
+        auto arbiter = slots[i].arbiter;
+        if (arbiter >= header.num_arbiters || arbiter_seen[arbiter]) {
+          return false;
+        }
+        arbiter_seen[arbiter] = 1;
+        ++live;
+        auto& record = arbiters[arbiter];
+        return slots[i].key == ArbiterKey(record.body_a, record.body_b).value();
+      });
+  if (!valid_slots || live != header.num_arbiters) {
+    return false;
+  }
+  if (tree) {
+    return ValidTree(header, reinterpret_cast<const TreeNodeFileRecord*>(
+        file.data() + header.broad_phase_offset));
+  }
+  return ValidSweepAndPrune(header, reinterpret_cast<const SapProxyFileRecord*>(
+      file.data() + header.broad_phase_offset));
+}
+
+bool World::LoadFile(const char* path) {
+  MappedFile file;
+  if (!file.Open(path) || !ValidateWorldFile(file)) {
+    return false;
+  }
+  auto& header = *reinterpret_cast<const WorldFileHeader*>(file.data());
+  auto body_records = reinterpret_cast<const BodyFileRecord*>(
+      file.data() + header.bodies_offset);
+  auto joint_records = reinterpret_cast<const JointFileRecord*>(
+      file.data() + header.joints_offset);
+  auto arbiter_records = reinterpret_cast<const ArbiterFileRecord*>(
+      file.data() + header.arbiters_offset);
+
+  Clear();
+  gravity_ = header.gravity;
+  time_to_sleep_ = header.time_to_sleep;
+  solver_settings_.velocity_iterations = header.velocity_iterations;
+  solver_settings_.sub_steps = header.sub_steps;
+  solver_settings_.tolerance = header.tolerance;
+  step_count_ = header.step;
+  Reserve(header.num_bodies, header.num_joints);
+  body_storage_.Reserve(header.num_bodies, header.num_vertices);
+
+  // The local vertices of all polygons in one block
+  auto vertices = vertex_arena_.Allocate<Vec2>(header.num_vertices);
+  if (header.num_vertices > 0) {
+    memcpy(vertices, file.data() + header.vertices_offset,
+           header.num_vertices * sizeof(Vec2));
+  }
+  auto& s = body_storage_;
+  for (size_t i = 0; i < header.num_bodies; ++i) {
+    auto& record = body_records[i];
+    Body* body = nullptr;
+    switch (static_cast<ShapeType>(record.shape_type)) {
+    case ShapeType::kPolygon:
+      body = new (polygon_pool_.Allocate()) PolygonBody(
+          s, record.mass, vertices + record.vertex_begin, record.vertex_count, false);
+      break;
+    case ShapeType::kCircle:
+      body = new (circle_pool_.Allocate()) CircleBody(s, record.mass, record.radius);
+      break;
+    }
+    AppendBody(body);
+    auto id = body->id_;
+    body->set_inertia(record.inertia);
+    s.centroid[id] = record.centroid;
+    s.friction[id] = record.friction;
+    s.bounce[id] = record.bounce;
+    s.bullet[id] = record.bullet;
+    s.position[id] = record.position;
+    s.rotation[id] = record.rotation;
+    s.velocity[id] = record.velocity;
+    s.angular_velocity[id] = record.angular_velocity;
+    s.force[id] = record.force;
+    s.torque[id] = record.torque;
+    s.sleep_time[id] = record.sleep_time;
+    s.awake[id] = record.awake;
+  }
+  SynchronizeBodies(0, false);
+  for (size_t i = 0; i < header.num_bodies; ++i) {
+    bodies_[i]->aabb_ = body_records[i].aabb;
+  }
+  if (header.broad_phase != static_cast<uint32_t>(broad_phase_type_)) {
+    AddProxies(0);
+  } else if (broad_phase_type_ == BroadPhaseType::kSweepAndPrune) {
+    auto records = reinterpret_cast<const SapProxyFileRecord*>(
+        file.data() + header.broad_phase_offset);
+    for (size_t i = 0; i < header.num_broad_phase; ++i) {
+      auto& aabb = records[i].aabb;
+      auto body = bodies_[records[i].body];
+      sap_.proxies_.push_back({aabb.lower.x, aabb.upper.x, aabb.lower.y, aabb.upper.y,
+                               body, body->mass() == kInf});
+      sap_.max_width_ = std::max(sap_.max_width_, aabb.upper.x - aabb.lower.x);
+    }
+  } else {
+    auto records = reinterpret_cast<const TreeNodeFileRecord*>(
+        file.data() + header.broad_phase_offset);
+    tree_.nodes_.resize(header.num_broad_phase);
+    for (size_t i = 0; i < header.num_broad_phase; ++i) {
+      auto& record = records[i];
+      auto& node = tree_.nodes_[i];
+      node.aabb = record.aabb;
+      node.parent = record.parent;
+      node.left = record.left;
+      node.right = record.right;
+      node.height = record.height;
+      // Only the leaves have a height of 0
+      if (record.height == 0) {
+        node.user_data = bodies_[record.body];
+        bodies_[record.body]->proxy_ = static_cast<int>(i);
+      }
+    }
+    tree_.root_ = header.tree_root;
+    tree_.free_list_ = header.tree_free_list;
+  }
+
+  for (size_t i = 0; i < header.num_joints; ++i) {
+    auto& record = joint_records[i];
+    auto& a = *bodies_[record.body_a];
+    auto& b = *bodies_[record.body_b];
+    VisitJointType(static_cast<JointType>(record.type), [&](auto tag) {
+      auto joint = NewJoint<typename decltype(tag)::Type>(a, b, record.anchor);
+      joint->local_anchor_a_ = record.local_anchor_a;
+      joint->local_anchor_b_ = record.local_anchor_b;
+      joint->p_ = record.impulse;
+      Add(joint);
+    });
+  }
+
+  // The slots as saved, untouched like after the sweep of a step
+  if (header.arbiter_capacity > 0) {
+    auto slot_records = reinterpret_cast<const ArbiterSlotFileRecord*>(
+        file.data() + header.arbiter_slots_offset);
+    arbiters_.Assign(header.arbiter_capacity, header.num_arbiter_slots,
+                     [slot_records](size_t i) { return slot_records[i].slot; },
+                     [slot_records](size_t i) { return slot_records[i].key; },
+                     [&](size_t i) {
+      auto& record = arbiter_records[slot_records[i].arbiter];
+      Arbiter::ContactList contacts;
+      for (size_t k = 0; k < record.num_contacts; ++k) {
+        auto& in = record.contacts[k];
+        Contact contact;
+        contact.position = in.position;
+        contact.ra = in.ra;
+        contact.rb = in.rb;
+        contact.from_a = {{in.from_a[0] != 0, in.from_a[1] != 0}};
+        contact.indices = {{in.indices[0], in.indices[1]}};
+        contact.separation = in.separation;
+        contact.pn = in.pn;
+        contact.pt = in.pt;
+        contacts.push_back(contact);
+      }
+      return new (arbiter_pool_.Allocate()) Arbiter(
+          record.body_a, record.body_b, record.normal, contacts);
+    });
+  }
+  if (publish_snapshots_) {
+    PublishSnapshot();
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "apollonia.h"
+#include "base/math.h"
+#include "broad_phase.h"
+#include <cstdint>
+
+namespace apollonia {
+
+// Layout of the flat binary checkpoints written by World::SaveFile().
+// A header is followed by arrays of the records below, each at a 16 byte
+// aligned offset, in native byte order. A loader maps the file and reads
+// the records in place. Any change to the records bumps the version.
+// Along with the bodies the broad phase and the warm start cache are kept
+// as they are, so a loaded world steps on exactly like the saved one.
+static const char kWorldFileMagic[8] = {'A', 'P', 'O', 'L', 'L', 'W', 'F', '\0'};
+static const uint32_t kWorldFileVersion = 4;
+static const uint32_t kWorldFileByteOrder = 0x01020304;
+
+struct WorldFileHeader {
+  char magic[8];
+  uint32_t version;
+  // Tell files of another byte order or Float type apart
+  uint32_t byte_order;
+  uint32_t float_size;
+  uint32_t velocity_iterations;
+  uint32_t sub_steps;
+  Float tolerance;
+  Vec2 gravity;
+  Float time_to_sleep;
+  uint64_t step;
+  uint64_t file_size;
+  uint64_t num_bodies;
+  uint64_t num_vertices;
+  uint64_t num_joints;
+  // Zero if the arbiters were not saved
+  uint64_t num_arbiters;
+  // Slots of the arbiter cache and those in use, zero if the arbiters
+  // were not saved
+  uint64_t arbiter_capacity;
+  uint64_t num_arbiter_slots;
+  // BroadPhaseType of the saved world, a world of the other type builds
+  // its broad phase anew
+  uint32_t broad_phase;
+  // Of the tree
+  int32_t tree_root;
+  int32_t tree_free_list;
+  // Tree nodes or sweep and prune boxes
+  uint64_t num_broad_phase;
+  uint64_t bodies_offset;
+  uint64_t vertices_offset;
+  uint64_t joints_offset;
+  uint64_t arbiters_offset;
+  uint64_t arbiter_slots_offset;
+  uint64_t broad_phase_offset;
+};
+
+// In the order of World::bodies(), the mass properties are stored so a
+// load does not compute them again
+struct BodyFileRecord {
+  uint8_t shape_type;
+  uint8_t awake;
+  uint8_t bullet;
+  Float mass;
+  Float inertia;
+  Vec2 centroid;
+  Float friction;
+  Float bounce;
+  Vec2 position;
+  Rot rotation;
+  Vec2 velocity;
+  Float angular_velocity;
+  Vec2 force;
+  Float torque;
+  Float sleep_time;
+  // Bounds as of the save, those of a sleeping body are not refreshed
+  AABB aabb;
+  // Circles
+  Float radius;
+  // Polygons, a range of the local vertices
+  uint64_t vertex_begin;
+  uint64_t vertex_count;
+};
+
+struct JointFileRecord {
+  uint8_t type;
+  uint32_t body_a;
+  uint32_t body_b;
+  Vec2 anchor;
+  Vec2 local_anchor_a;
+  Vec2 local_anchor_b;
+  // Accumulated impulse
+  Vec2 impulse;
+};
+
+// An arbiter of the warm start cache, the contacts keep what matches
+// them to the next contacts and their accumulated impulses
+struct ArbiterFileRecord {
+  struct ContactRecord {
+    Vec2 position;
+    Vec2 ra;
+    Vec2 rb;
+    uint8_t from_a[2];
+    uint32_t indices[2];
+    Float separation;
+    Float pn;
+    Float pt;
+  };
+
+  uint32_t body_a;
+  uint32_t body_b;
+  Vec2 normal;
+  uint32_t num_contacts;
+  ContactRecord contacts[2];
+};
+
+// A slot in use of the arbiter cache, live or a tombstone, in the order of
+// the table
+struct ArbiterSlotFileRecord {
+  uint64_t key;
+  uint32_t slot;
+  // Index of the arbiter record of a live slot
+  uint32_t arbiter;
+};
+
+// A node of the tree in the order of the node array, a leaf refers to its
+// body by index and the other nodes by -1
+struct TreeNodeFileRecord {
+  AABB aabb;
+  int32_t body;
+  // The next free node for those in the free list
+  int32_t parent;
+  int32_t left;
+  int32_t right;
+  int32_t height;
+};
+
+// A box of the sweep and prune in its sorted order
+struct SapProxyFileRecord {
+  AABB aabb;
+  uint32_t body;
+};
+
+}
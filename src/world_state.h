@@ -0,0 +1,46 @@
+#pragma once
+
+#include "apollonia.h"
+#include "arbiter_cache.h"
+#include "base/allocator.h"
+#include "base/math.h"
+#include "broad_phase.h"
+#include "collision.h"
+#include <cstdint>
+
+namespace apollonia {
+
+// Dynamic state of a world saved by World::SaveState(), copied array by
+// array so a save of a warm state allocates nothing.
+struct WorldState {
+  bool valid {false};
+  uint64_t step {0};
+  // Sizes of the world saved, a restore needs the same
+  size_t num_bodies {0};
+  size_t num_joints {0};
+
+  // Indexed by BodyId
+  Vector<Vec2>  velocity;
+  Vector<Float> angular_velocity;
+  Vector<uint8_t> awake;
+  Vector<Vec2>  position;
+  Vector<Rot>   rotation;
+  Vector<Vec2>  force;
+  Vector<Float> torque;
+  Vector<Float> sleep_time;
+  Vector<AABB>  aabb;
+  Vector<Vec2>  world_vertices;
+  Vector<Vec2>  world_normals;
+  Vector<Float> world_x;
+  Vector<Float> world_y;
+
+  AABBTree tree;
+  SweepAndPrune sap;
+  // The slots point to 'arbiters'
+  ArbiterCache arbiter_cache;
+  Vector<Arbiter> arbiters;
+  // Accumulated impulses in the order of World::joints()
+  Vector<Vec2> joint_impulses;
+};
+
+}